@@ -5,26 +5,9 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 #include "loudmon/debug_output.h"
+#include "common/meter_kernels.h"
 
 
-std::string MainInfo::to_string() const {
-  std::stringstream ss;
-  ss << "FPS: " << fps_ << std::endl
-     << "Latency(out/in/max/late): " << std::fixed << std::setprecision(2) << std::setfill('0')
-     << process_block_interval_*1000 << "/" << latency_ms_ << "/" << latency_max_expected_ << "/" << late_block_count_ << std::endl
-     << "Sample Rate: " << sample_rate_ << ", Samples per Block: " << samples_per_block_ << ", Input channels: " << input_channels_ << std::endl
-     << "Input RMS: ";
-  for (float value : input_rms_) {
-    ss << std::fixed << std::setprecision(2) << std::setfill('0') << value << "dB ";
-  }
-  ss << std::endl;
-  for (auto &key : display_value_keys_in_order_) {
-    ss << key << ": " << display_values_.at(key) << std::endl;
-  }
-  ss << "Entropy: " << entropy_ << std::endl;
-  return ss.str();
-}
-
 // This function is written so we can put menu implementation in cpp file
 //  rather than in class definition of the header file.
 static auto get_menu_items(MainComponent *that) {
@@ -44,16 +27,31 @@ static auto get_menu_items(MainComponent *that) {
       {
           "Debug",
           {
-              {"Toggle Debug Window", std::bind(&MainComponent::toggle_debug_window, that)}
+              {"Toggle Debug Window", std::bind(&MainComponent::toggle_debug_window, that)},
+              {"Toggle Verbose Log", std::bind(&MainComponent::toggle_verbose_log, that)},
+              {"Toggle Log File", std::bind(&MainComponent::toggle_log_file, that)},
+#if JUCE_UNIT_TESTS
+              {"Run Unit Tests", std::bind(&MainComponent::run_unit_tests, that)},
+#endif
           }
       },
       {
           "Filter",
           {
               {"Toggle Main Filter", std::bind(&MainComponent::toggle_main_filter, that)},
+              {"Toggle SVF Mode", std::bind(&MainComponent::toggle_main_filter_mode, that, MainFilter::ModeStateVariable)},
+              {"Toggle Linear Phase", std::bind(&MainComponent::toggle_main_filter_mode, that, MainFilter::ModeLinearPhase)},
               {"Toggle Oscilloscope", std::bind(&MainComponent::toggle_oscilloscope, that)}
           }
       },
+      {
+          "Loudness",
+          {
+              {"Normalize to -23 LUFS", std::bind(&MainComponent::normalize_loudness, that, true, -23.0f)},
+              {"Normalize to -14 LUFS", std::bind(&MainComponent::normalize_loudness, that, true, -14.0f)},
+              {"Normalization Off", std::bind(&MainComponent::normalize_loudness, that, false, -23.0f)},
+          }
+      },
       {
         "Control",
             {
@@ -66,11 +64,16 @@ static auto get_menu_items(MainComponent *that) {
 
 MainComponent::MainComponent(NewProjectAudioProcessor& p)
     : AudioProcessorEditor(p),
-      main_info_(std::bind(&MainComponent::repaint_safe, this)),
+      processor_(p),
+      metrics_(p.get_metrics()),
+      keyboard_midi_(p.get_keyboard_midi()),
+      main_filter_(p.get_main_filter()),
+      analysis_governor_(p.get_analysis_governor()),
       menu_items_(get_menu_items(this)),
       menu_bar_(this),
       oscilloscope_waveform_(256),
-      keyboard_(keyboard_state_, juce::MidiKeyboardComponent::Orientation::horizontalKeyboard) {
+      keyboard_(keyboard_state_, juce::MidiKeyboardComponent::Orientation::horizontalKeyboard),
+      synth_control_(p.get_synth_parameters()) {
 
 //  debug_plot.set_value_range(0, 1, 0, 1, false, false);
 //  debug_plot.add_new_values("1", {{0.1f, -0.1f}, {0.5f, 0.5f}, {0.9f, 1.1f}});
@@ -87,6 +90,7 @@ MainComponent::MainComponent(NewProjectAudioProcessor& p)
 
   addAndMakeVisible(menu_bar_);
 
+  keyboard_state_.addListener(&keyboard_midi_);
   addAndMakeVisible(keyboard_);
   addAndMakeVisible(synth_control_);
 
@@ -102,6 +106,9 @@ MainComponent::MainComponent(NewProjectAudioProcessor& p)
   oscilloscope_waveform_.setVisible(oscilloscope_enabled_);
   oscilloscope_spectrum_.setVisible(oscilloscope_enabled_);
   oscilloscope_spectrum_.set_value_range(20, 20000, -50, 10, true, false);
+  for (auto &tier : AnalysisTiers) {
+    ffts_.push_back(std::make_unique<dsp::FFT>(tier.fft_order));
+  }
 
   debug_window = new DebugOutputWindow("Debug Window", Colour(0), true);
   debug_window->setSize(1024, 400);
@@ -111,6 +118,10 @@ MainComponent::MainComponent(NewProjectAudioProcessor& p)
 }
 
 MainComponent::~MainComponent() {
+  stop_ui_updater();
+  // Notes held on the keyboard would otherwise hang once the editor is gone
+  keyboard_state_.allNotesOff(0);
+  keyboard_state_.removeListener(&keyboard_midi_);
   if (debug_window) {
     debug_window.deleteAndZero();
     debug_window = nullptr;
@@ -159,13 +170,50 @@ void MainComponent::toggle_debug_window() {
     debug_window->setVisible(debug_window_visible_ && isVisible());
   }
 }
+void MainComponent::toggle_verbose_log() {
+  AsyncLogger::set_level(AsyncLogger::get_level() >= LogLevelVerbose ? LogLevelDefault : LogLevelVerbose);
+}
+void MainComponent::toggle_log_file() {
+  log_file_enabled_ = !log_file_enabled_;
+  auto file = File::getSpecialLocation(File::userApplicationDataDirectory)
+      .getChildFile("A1ex").getChildFile("loudmon").getChildFile("loudmon.log");
+  AsyncLogger::instance().set_log_file(log_file_enabled_ ? file : File());
+}
+#if JUCE_UNIT_TESTS
+void MainComponent::run_unit_tests() {
+  // On the message thread, the UI stalls until they are done
+  UnitTestRunner runner;
+  runner.runTestsInCategory("loudmon");
+  for (int i = 0; i < runner.getNumResults(); i++) {
+    auto result = runner.getResult(i);
+    log(LogLevelDefault, (result->unitTestName + " / " + result->subcategoryName + ": " + String(result->passes)
+        + " passed, " + String(result->failures) + " failed").toStdString());
+  }
+}
+#endif
 void MainComponent::toggle_main_filter() {
-  auto enabled = !main_filter_enabled.fetch_xor(1);
+  auto enabled = !main_filter_.is_enabled();
+  main_filter_.set_enabled(enabled);
+  processor_.update_latency();
+  processor_.update_chain();
   if (filter) {
     filter->setVisible(enabled);
     resize_children();
   }
 }
+void MainComponent::toggle_main_filter_mode(MainFilter::Mode mode) {
+  main_filter_.set_mode(main_filter_.mode() == mode ? MainFilter::ModeEqualizer : mode);
+  processor_.update_latency();
+  if (filter) {
+    filter->update_coefficients();
+  }
+}
+void MainComponent::normalize_loudness(bool enabled, float target) {
+  auto &normalizer = processor_.get_loudness_normalizer();
+  normalizer.set_target(target);
+  normalizer.set_enabled(enabled);
+  processor_.update_latency();
+}
 void MainComponent::toggle_oscilloscope() {
   auto enabled = !oscilloscope_enabled_.fetch_xor(1);
   oscilloscope_waveform_.setVisible(enabled);
@@ -180,26 +228,52 @@ void MainComponent::visibilityChanged() {
 }
 
 void MainComponent::paint(Graphics& g) {
+  g.fillAll(Colour::fromRGB(0, 0, 0));
+}
+
+void MainComponent::ui_frame() {
+  // Frame statistics change every frame, they are averaged and shown a few times per second so that
+  //  the info text is not formatted again on every frame
+  frames_since_stats_++;
   auto now = std::chrono::high_resolution_clock::now();
-  main_info_.set_fps(1 / std::chrono::duration<float>(now-last_paint_time).count());
-  last_paint_time = now;
+  auto elapsed = std::chrono::duration<float>(now - last_stats_time_).count();
+  if (elapsed >= stats_interval_seconds) {
+    metrics_.set(MetricFps, static_cast<float>(frames_since_stats_) / elapsed);
+    metrics_.set(MetricUIQueue, 0, get_average_ui_latency()*1000);
+    metrics_.set(MetricUIQueue, 1, static_cast<float>(get_ui_queue_size()));
+    metrics_.set(MetricUIQueue, 2, static_cast<float>(get_ui_queue_loss()));
+    metrics_.set(MetricUIQueue, 3, static_cast<float>(get_ui_queue_coalesced()));
+    metrics_.set(MetricUIProcessingLatency, get_average_ui_processing_latency()*1000);
+    last_stats_time_ = now;
+    frames_since_stats_ = 0;
+  }
 
-  g.fillAll(Colour::fromRGB(0, 0, 0));
+  update_info_text();
+  synth_control_.update_waveform();
+  if (dirty_flags_ & DirtyWaveform) {
+    oscilloscope_waveform_.repaint();
+  }
+  if (dirty_flags_ & DirtySpectrum) {
+    oscilloscope_spectrum_.repaint();
+  }
+  dirty_flags_ = 0;
 }
 
+void MainComponent::update_info_text() {
+  // Only the metrics that changed are formatted again
+  if (metrics_.format_changed()) {
+    // Label only repaints itself when the text actually changed
+    info_text.setText(metrics_.text(), dontSendNotification);
+  }
+}
 
-void MainComponent::prepare_to_play(double sample_rate, size_t samples_per_block, size_t input_channels) {
-  enqueue_ui([this, sample_rate, samples_per_block, input_channels]() {
-    main_info_.set_sample_rate(sample_rate);
-    main_info_.set_samples_per_block(samples_per_block);
-    main_info_.set_input_channels(input_channels);
 
+void MainComponent::prepare_to_play(double sample_rate, size_t /*samples_per_block*/, size_t /*input_channels*/) {
+  enqueue_ui([this, sample_rate]() {
     // automatically delete old filter and replace it with the new one
-    filter = std::make_unique<FilterTransferFunctionComponent>(static_cast<float>(sample_rate), input_channels);
+    filter = std::make_unique<FilterTransferFunctionComponent>(main_filter_, static_cast<float>(sample_rate));
     addChildComponent(*filter);
-    filter->setVisible(main_filter_enabled);
-
-    synth_control_.set_sample_rate(static_cast<float>(sample_rate));
+    filter->setVisible(is_main_filter_enabled());
     resize_children();
   });
 }
@@ -219,74 +293,142 @@ void MainComponent::resize_children() {
     oscilloscope_spectrum_.setBounds(area.removeFromTop(total_height/8*3));
   }
 
-  if (filter && main_filter_enabled) {
+  if (filter && is_main_filter_enabled()) {
     filter->setBounds(area);
   }
 }
 
 void MainComponent::send_block(float sample_rate, AudioBuffer<float> buffer) {
   enqueue_ui([this, sample_rate, buffer{std::move(buffer)}]() {
-    buffer_ = buffer;
+    auto &tier = analysis_governor_.settings();
+    auto block = block_count_++;
     if (oscilloscope_enabled_) {
-      oscilloscope_waveform_.add_values(buffer_.getArrayOfReadPointers()[0], buffer_.getNumSamples());
+      oscilloscope_waveform_.add_values(buffer.getReadPointer(0), static_cast<size_t>(buffer.getNumSamples()),
+                                        tier.oscilloscope_decimation);
+      mark_dirty(DirtyWaveform);
+      if (block % tier.spectrum_interval == 0) {
+        calculate_spectrum(sample_rate, buffer);
+      }
+    }
 
-      calculate_spectrum();
+    if (block % tier.entropy_interval == 0) {
+      calculate_entropy(buffer);
+    }
+    calculate_peak(buffer);
+  });
+}
 
-      std::vector<std::tuple<float, float>> values(spectrum_buffer_.getNumSamples() / 2 + 1);
-      auto buf = spectrum_buffer_.getReadPointer(0);
-      for (int i = 0; i < values.size(); i++) {
-        values[i] = {float(i) / spectrum_buffer_.getNumSamples() * sample_rate, 10 * log10(buf[i])};
-        if (buf[i] > 0) {
-          log(10, std::to_string(std::get<0>(values[i])) + " " + std::to_string(std::get<1>(values[i])));
-        }
+void MainComponent::calculate_spectrum(float sample_rate, const AudioBuffer<float> &buffer) {
+  // Runs on a UI processing worker, only the result is handed back to the UI thread
+  // Jobs may finish out of order, the UI thread drops a spectrum older than the one it shows
+  auto sequence = ++spectrum_sequence_;
+  enqueue_ui_processing([this, sample_rate, buffer, sequence]() {
+    // The size is the analysis tier's when the job starts
+    auto &fft = *ffts_[analysis_governor_.tier()];
+    auto spectrum_size = static_cast<size_t>(fft.getSize());
+    // Hann windowed and zero padded to the transform size. The real-only transform works in place
+    //  on twice the size.
+    auto samples = std::min(static_cast<size_t>(buffer.getNumSamples()), spectrum_size);
+    if (samples < 2) {
+      return;
+    }
+    std::vector<float> spectrum(spectrum_size * 2, 0);
+    auto input = buffer.getReadPointer(0);
+    float window_sum = 0;
+    for (size_t i = 0; i < samples; i++) {
+      auto window = 0.5f - 0.5f * std::cos(2 * MathConstants<float>::pi * i / (samples - 1));
+      spectrum[i] = input[i] * window;
+      window_sum += window;
+    }
+    fft.performFrequencyOnlyForwardTransform(spectrum.data());
+
+    // Scaled so that a full scale sine reads 0dB
+    auto bins = spectrum_size / 2 + 1;
+    FloatVectorOperations::multiply(spectrum.data(), 2 / window_sum, static_cast<int>(bins));
+    meter_kernels().to_db(spectrum.data(), spectrum.data(), bins, 20, spectrum_floor_db);
+
+    static const auto spectrum_log_format = AsyncLogger::instance().register_format("%f %f");
+    std::vector<std::tuple<float, float>> values(bins);
+    for (size_t i = 0; i < bins; i++) {
+      values[i] = {float(i) / spectrum_size * sample_rate, spectrum[i]};
+      if (spectrum[i] > spectrum_floor_db) {
+        log(LogLevelVerbose, spectrum_log_format, std::get<0>(values[i]), std::get<1>(values[i]));
       }
+    }
 
+    enqueue_ui(UIMessageKey::Spectrum, [this, sequence, values{std::move(values)}]() mutable {
+      if (sequence <= shown_spectrum_sequence_) {
+        return;
+      }
+      shown_spectrum_sequence_ = sequence;
       oscilloscope_spectrum_.clear();
       oscilloscope_spectrum_.add_new_values("spectrum", std::move(values));
-      oscilloscope_spectrum_.repaint();
-    }
-
-    calculate_entropy();
+      mark_dirty(DirtySpectrum);
+    });
   });
 }
 
-void MainComponent::calculate_spectrum() {
-  LagrangeInterpolator interpolator;
-  double ratio = (double)buffer_.getNumSamples() / spectrum_buffer_.getNumSamples();
-  interpolator.process(
-      ratio,
-      buffer_.getReadPointer(0),
-      spectrum_buffer_.getWritePointer(0),
-      spectrum_buffer_.getNumSamples());
-//  fft_.performFrequencyOnlyForwardTransform(spectrum_buffer_.getWritePointer(0));
+// c log2(c), the entropy of counts c with total n is log2(n) - sum(c log2(c)) / n
+static double count_log_count(size_t count) {
+  return count > 0 ? static_cast<double>(count) * std::log2(static_cast<double>(count)) : 0;
 }
 
-void MainComponent::calculate_entropy() {
-  enqueue_ui_processing([this]() {
-    auto buf = buffer_.getReadPointer(0);
-    for (auto i = 0; i < buffer_.getNumSamples(); i++) {
-      auto sample_value = size_t((buf[i] + 1) / 2 * float(1ul << entropy_bits));
-      if (sample_value >= value_counts_.size()) {
-        sample_value = value_counts_.size() - 1;
+void MainComponent::calculate_entropy(const AudioBuffer<float> &buffer) {
+  enqueue_ui_processing([this, buffer]() {
+    // The block is binned into this worker's own histogram, the shared one is only locked to merge
+    //  the bins that changed. Jobs may run on several workers at once.
+    thread_local std::vector<size_t> block_counts;
+    thread_local std::vector<std::pair<size_t, size_t>> changed;
+    block_counts.resize(value_counts_.size());
+    // [-1, 1] spread over the bins, anything outside lands in the first or the last one
+    meter_kernels().histogram(buffer.getReadPointer(0), static_cast<size_t>(buffer.getNumSamples()), 1,
+                              float(1ul << entropy_bits) / 2, block_counts.data(), block_counts.size());
+    changed.clear();
+    for (size_t bin = 0; bin < block_counts.size(); bin++) {
+      if (block_counts[bin] != 0) {
+        changed.emplace_back(bin, block_counts[bin]);
+        block_counts[bin] = 0;
       }
-      value_counts_[sample_value]++;
     }
-    size_t total_count = std::accumulate(value_counts_.begin(), value_counts_.end(), size_t(0));
+
     double entropy = 0;
-    for (auto value_count : value_counts_) {
-      double p = double(value_count) / total_count;
-      if (p > 0) {
-        entropy += -p * log2(p);
+    {
+      std::unique_lock<std::mutex> _(value_counts_lock_);
+      for (auto [bin, count] : changed) {
+        auto &total = value_counts_[bin];
+        value_count_log_sum_ += count_log_count(total + count) - count_log_count(total);
+        total += count;
+        value_count_total_ += count;
+      }
+      if (value_count_total_ > 0) {
+        auto total = static_cast<double>(value_count_total_);
+        entropy = std::log2(total) - value_count_log_sum_ / total;
       }
     }
-    enqueue_ui([this, entropy]() {
-      main_info_.set_entropy(entropy);
-    });
+    metrics_.set(MetricEntropy, static_cast<float>(entropy));
+  });
+}
+
+void MainComponent::calculate_peak(const AudioBuffer<float> &buffer) {
+  enqueue_ui_processing([this, buffer]() {
+    auto channels = std::min(static_cast<size_t>(buffer.getNumChannels()), max_peak_channels);
+    float peaks[max_peak_channels];
+    for (size_t channel = 0; channel < channels; channel++) {
+      peaks[channel] = meter_kernels().abs_peak(buffer.getReadPointer(static_cast<int>(channel)),
+                                                static_cast<size_t>(buffer.getNumSamples()));
+    }
+    meter_kernels().to_db(peaks, peaks, channels, 20, spectrum_floor_db);
+    for (size_t channel = 0; channel < channels; channel++) {
+      metrics_.set(MetricOutputPeak, channel, peaks[channel]);
+    }
   });
 }
 
 void MainComponent::reset_entropy() {
   enqueue_ui_processing([this]() {
+    std::unique_lock<std::mutex> _(value_counts_lock_);
     std::fill(value_counts_.begin(), value_counts_.end(), 0);
+    value_count_total_ = 0;
+    value_count_log_sum_ = 0;
   });
 }
@@ -1,8 +1,6 @@
 #pragma once
 
-#include <list>
 #include <string>
-#include <map>
 #include <utility>
 
 #include <JuceHeader.h>
@@ -13,74 +11,6 @@
 #include "common/ui_updater.h"
 
 class DebugOutputWindow;
-class MainInfo {
- public:
-  explicit MainInfo(std::function<void()> update_callback) : update_callback_(std::move(update_callback)) { }
-  void set_sample_rate(double sample_rate) {
-    sample_rate_ = sample_rate;
-    update_callback_();
-  }
-  void set_samples_per_block(size_t value) {
-    samples_per_block_ = value;
-    update_callback_();
-  }
-  void set_fps(float fps) {
-    fps_ = fps;
-    update_callback_();
-  }
-  void set_input_rms(std::vector<float> values) {
-    input_rms_ = std::move(values);
-    update_callback_();
-  }
-  void set_latency(float ms, float max_expected, size_t late) {
-    latency_ms_ = ms;
-    latency_max_expected_ = max_expected;
-    late_block_count_ = late;
-    update_callback_();
-  }
-  void set_process_block_interval(float seconds) {
-    process_block_interval_ = seconds;
-    update_callback_();
-  }
-  void set_input_channels(size_t n) {
-    input_channels_ = n;
-    update_callback_();
-  }
-  void set_entropy(double entropy) {
-    entropy_ = entropy;
-    update_callback_();
-  }
-
-  void add_display_value(const std::string& key, float value) {
-    std::stringstream ss;
-    ss << std::fixed << std::setprecision(3) << value;
-    display_values_[key] = ss.str();
-  }
-  void add_display_value(const std::string& key, std::string value) {
-    if (display_values_.find(key) == display_values_.end()) {
-      display_value_keys_in_order_.push_back(key);
-    }
-    display_values_[key] = std::move(value);
-  }
-
-  [[nodiscard]]
-  std::string to_string() const;
- private:
-  friend class MainComponent;
-  double sample_rate_ = 44100;
-  size_t samples_per_block_ = 2048;
-  size_t input_channels_ = 2;
-  float fps_ = 0;
-  std::vector<float> input_rms_;
-  float latency_ms_ = 0, latency_max_expected_ = 0, process_block_interval_ = 0;
-  size_t late_block_count_ = 0;
-  double entropy_ = 0;
-
-  std::map<std::string, std::string> display_values_;
-  std::list<std::string> display_value_keys_in_order_;
-  std::function<void()> update_callback_;
-};
-
 class MainComponent : public AudioProcessorEditor, public UIUpdater, public juce::MenuBarModel {
  public:
   explicit MainComponent(NewProjectAudioProcessor& p);
@@ -95,12 +25,22 @@ class MainComponent : public AudioProcessorEditor, public UIUpdater, public juce
 
   [[nodiscard]]
   bool is_main_filter_enabled() const {
-    return main_filter_enabled.load();
+    return main_filter_.is_enabled();
   }
 
   void toggle_debug_window();
+  void toggle_verbose_log();
+  void toggle_log_file();
+#if JUCE_UNIT_TESTS
+  // The tests of the "loudmon" category, results go to the log
+  void run_unit_tests();
+#endif
   void toggle_main_filter();
+  // Switches between mode and the equalizer
+  void toggle_main_filter_mode(MainFilter::Mode mode);
   void toggle_oscilloscope();
+  // Drives the output to target LUFS
+  void normalize_loudness(bool enabled, float target);
 
   /* Component callbacks, UI thread */
   void visibilityChanged() override;
@@ -108,71 +48,20 @@ class MainComponent : public AudioProcessorEditor, public UIUpdater, public juce
   void resized() override {
     resize_children();
   }
+  // Once per UI frame, after the queued messages ran
+  void ui_frame() override;
 
   /* May be in any thread */
-  void set_input_rms(const std::vector<float>& values) {
-    enqueue_ui([this, values]() {
-      main_info_.set_input_rms(values);
-      repaint();
-    });
-  }
-  void set_latency_ms(float ms, float max_expected, size_t late) {
-    enqueue_ui([this, ms, max_expected, late]() {
-      main_info_.set_latency(ms, max_expected, late);
-      repaint();
-    });
-  }
-  void set_process_block_interval(float seconds) {
-    enqueue_ui([this, seconds]() {
-      main_info_.set_process_block_interval(seconds);
-      repaint();
-    });
-  }
-  void repaint_safe() {
-    enqueue_ui([this]() {
-      std::stringstream ss;
-      ss << main_info_.to_string();
-      ss << "Queue: UI " << std::fixed << std::setprecision(1) << get_average_ui_latency()*1000 << "ms" << "/" << get_ui_queue_size() << "/" << get_ui_queue_loss() << std::endl <<
-         "UI proc: " << get_average_ui_processing_latency()*1000 << "ms" << std::endl;
-      info_text.setText(ss.str(), dontSendNotification);
-      repaint();
-    });
-  }
-
   void prepare_to_play(double sample_rate, size_t samples_per_block, size_t input_channels);
 
-  template <typename Context>
-  void filter_process(int channel, Context &context) {
-    if (filter) {
-      filter->process(channel, context);
-    }
-  }
-
-  void calculate_spectrum();
-  void calculate_entropy();
+  // UI thread, it numbers the spectrum jobs
+  void calculate_spectrum(float sample_rate, const AudioBuffer<float> &buffer);
+  void calculate_entropy(const AudioBuffer<float> &buffer);
+  // Per channel sample peak of the block, into the metrics
+  void calculate_peak(const AudioBuffer<float> &buffer);
   void reset_entropy();
   void send_block(float sample_rate, AudioBuffer<float> buffer);
 
-  void add_display_value(const std::string& key, std::string value) {
-    enqueue_ui([this, key, value{std::move(value)}]() {
-      main_info_.add_display_value(key, value);
-      repaint();
-    });
-  }
-  void add_display_value(const std::string& key, float value) {
-    enqueue_ui([this, key, value]() {
-      main_info_.add_display_value(key, value);
-      repaint();
-    });
-  }
-
-  MidiBuffer get_keyboard_midi_buffer(size_t sample_count) {
-    MidiBuffer ret;
-    // this is thread safe, so we don't need a lock
-    keyboard_state_.processNextMidiBuffer(ret, 0, static_cast<int>(sample_count), true);
-    return ret;
-  }
-
   SynthControl &get_synth_control() {
     return synth_control_;
   }
@@ -181,7 +70,31 @@ class MainComponent : public AudioProcessorEditor, public UIUpdater, public juce
   void resize_children();
 
  private:
-  MainInfo main_info_;
+  // Coalescing keys for enqueue_ui, only the latest message of each kind is kept
+  enum UIMessageKey : uint64_t {
+    Spectrum = 1,
+  };
+
+ private:
+  // Components that need a repaint in the next UI frame
+  enum DirtyFlags : uint32_t {
+    DirtyWaveform = 1u << 0u,
+    DirtySpectrum = 1u << 1u,
+  };
+  void mark_dirty(uint32_t flags) {
+    dirty_flags_ |= flags;
+  }
+  void update_info_text();
+
+ private:
+  NewProjectAudioProcessor &processor_;
+  // Owned by the processor, so that the audio thread never has to touch the editor to publish values
+  MetricRegistry &metrics_;
+  KeyboardMidiQueue &keyboard_midi_;
+  uint32_t dirty_flags_ = 0;
+  std::chrono::high_resolution_clock::time_point last_stats_time_;
+  size_t frames_since_stats_ = 0;
+  static constexpr float stats_interval_seconds = 0.5f;
 
   juce::MenuBarComponent menu_bar_;
   std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::function<void()>>>>> menu_items_;
@@ -194,16 +107,28 @@ class MainComponent : public AudioProcessorEditor, public UIUpdater, public juce
 
   Component::SafePointer<DebugOutputWindow> debug_window;
   bool debug_window_visible_ = false;
+  bool log_file_enabled_ = false;
 
-  std::atomic<int> main_filter_enabled = false;
+  MainFilter &main_filter_;
   std::unique_ptr<FilterTransferFunctionComponent> filter;
-  std::chrono::high_resolution_clock::time_point last_paint_time;
-  dsp::FFT fft_ = dsp::FFT(11);
-  AudioBuffer<float> buffer_;
-  AudioBuffer<float> spectrum_buffer_ = AudioBuffer<float>(1, 1ul<<12);
+  const AnalysisGovernor &analysis_governor_;
+  // One per analysis tier, the tiers differ in size
+  std::vector<std::unique_ptr<dsp::FFT>> ffts_;
+  // Blocks received, the analysis intervals count these. UI thread.
+  size_t block_count_ = 0;
+  // Spectrum jobs in the order they were started, and the newest one on screen. UI thread.
+  size_t spectrum_sequence_ = 0;
+  size_t shown_spectrum_sequence_ = 0;
+  // What silence reads, in the spectrum and the peak meter
+  static constexpr float spectrum_floor_db = -100;
+  static constexpr size_t max_peak_channels = 8;
 
   const size_t entropy_bits = 16;
   std::vector<size_t> value_counts_ = std::vector<size_t>(size_t(int(1 << entropy_bits)), size_t(0));
+  // Under value_counts_lock_, what the entropy is computed from without visiting every bin
+  size_t value_count_total_ = 0;
+  double value_count_log_sum_ = 0;
+  std::mutex value_counts_lock_;
 
   juce::MidiKeyboardState keyboard_state_;
   juce::MidiKeyboardComponent keyboard_;
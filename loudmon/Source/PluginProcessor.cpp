@@ -2,6 +2,8 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "loudmon/utils.h"
+#include "common/meter_kernels.h"
 
 //==============================================================================
 NewProjectAudioProcessor::NewProjectAudioProcessor()
@@ -14,25 +16,42 @@ NewProjectAudioProcessor::NewProjectAudioProcessor()
                        )
 #endif
 {
+  register_metrics();
+  update_chain();
 
   synthesiser_.enableLegacyMode(24);
-  synthesiser_.setVoiceStealingEnabled(false);
-  // Start with the max number of voices
-  for (auto i = 0; i != 16; ++i) {
-    synthesiser_.addVoice(new MPESimpleVoice([this]() -> SynthControl* {
-      auto editor = dynamic_cast<MainComponent*>(getActiveEditor());
-      if (editor) {
-        return &editor->get_synth_control();
-      } else {
-        return nullptr;
-      }
-    }));
-  }
+  // Notes beyond the pool steal the least important voice instead of being dropped
+  synthesiser_.setVoiceStealingEnabled(true);
+#if JucePlugin_IsSynth
+  // Half of the cores stay free for other tracks and instances
+  auto helpers = clip(static_cast<int>(std::thread::hardware_concurrency()) / 2 - 1, 0, 3);
+  synthesiser_.set_worker_count(static_cast<size_t>(helpers));
+#endif
 }
 
 NewProjectAudioProcessor::~NewProjectAudioProcessor() {
 }
 
+void NewProjectAudioProcessor::register_metrics() {
+  metrics_.register_metric(MetricFps, {"FPS", "", 1});
+  metrics_.register_metric(MetricLatency, {"Latency(out/in/max)", "ms", 2, 3, "/"});
+  metrics_.register_metric(MetricLateBlocks, {"Late blocks", "", 0});
+  metrics_.register_metric(MetricVoices, {"Voices(active/stolen)", "", 0, 2, "/"});
+  metrics_.register_metric(MetricSampleRate, {"Sample Rate", "", 0});
+  metrics_.register_metric(MetricSamplesPerBlock, {"Samples per Block", "", 0});
+  metrics_.register_metric(MetricInputChannels, {"Input channels", "", 0});
+  metrics_.register_metric(MetricInputRms, {"Input RMS", "dB", 2, max_synth_channels});
+  metrics_.register_metric(MetricOutputLowRms, {"Output Low RMS", "dB", 2, max_synth_channels});
+  metrics_.register_metric(MetricOutputMidRms, {"Output Mid RMS", "dB", 2, max_synth_channels});
+  metrics_.register_metric(MetricOutputHighRms, {"Output High RMS", "dB", 2, max_synth_channels});
+  metrics_.register_metric(MetricOutputPeak, {"Output Peak", "dB", 2, max_synth_channels});
+  metrics_.register_metric(MetricLoudness, {"Loudness(short-term/gain/limiter)", "dB", 1, 3, "/"});
+  metrics_.register_metric(MetricEntropy, {"Entropy", "", 6});
+  metrics_.register_metric(MetricAnalysis, {"Analysis(tier/load)", "", 2, 2, "/"});
+  metrics_.register_metric(MetricUIQueue, {"Queue: UI(ms/size/loss/coalesced)", "", 1, 4, "/"});
+  metrics_.register_metric(MetricUIProcessingLatency, {"UI proc", "ms", 1});
+}
+
 const String NewProjectAudioProcessor::getName() const {
   return JucePlugin_Name;
 }
@@ -83,25 +102,63 @@ IIRCoefficients operator+(const IIRCoefficients &lhs, const IIRCoefficients &rhs
 //==============================================================================
 void NewProjectAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock) {
   auto editor = dynamic_cast<MainComponent*>(getActiveEditor());
-  auto input_channels = getTotalNumInputChannels();
-  auto output_channels = getTotalNumOutputChannels();
-  assert(input_channels == 0 || input_channels == 2);
-  assert(output_channels == 2);
+  auto input_channels = static_cast<size_t>(getTotalNumInputChannels());
+  // isBusesLayoutSupported allows mono and stereo, with an input that matches the output
+  synth_channels = static_cast<size_t>(getTotalNumOutputChannels());
+  assert(synth_channels == 1 || synth_channels == 2);
+  assert(input_channels == 0 || input_channels == synth_channels);
   if (editor) {
     editor->prepare_to_play(sampleRate, samplesPerBlock, synth_channels);
   }
+  metrics_.set(MetricSampleRate, static_cast<float>(sampleRate));
+  metrics_.set(MetricSamplesPerBlock, static_cast<float>(samplesPerBlock));
+  metrics_.set(MetricInputChannels, static_cast<float>(synth_channels));
+  for (auto metric : {MetricInputRms, MetricOutputLowRms, MetricOutputMidRms, MetricOutputHighRms, MetricOutputPeak}) {
+    metrics_.set_value_count(metric, synth_channels);
+  }
 
-  synthesiser_.setCurrentPlaybackSampleRate(sampleRate);
+  synthesiser_.prepare(sampleRate, micro_block_size);
+  float_buffers_.prepare(sampleRate, synth_channels, micro_block_size, freq_split_lowmid, freq_split_midhigh, q);
+  double_buffers_.prepare(sampleRate, synth_channels, micro_block_size, freq_split_lowmid, freq_split_midhigh, q);
+  merged_midi_.ensureSize(merged_midi_reserved_bytes);
+  main_filter_.prepare(sampleRate, synth_channels, micro_block_size);
+  loudness_normalizer_.prepare(sampleRate, synth_channels, micro_block_size);
+  update_latency();
+  update_chain();
+  block_index_ = 0;
+  input_energy_.assign(synth_channels, 0);
+  low_energy_.assign(synth_channels, 0);
+  mid_energy_.assign(synth_channels, 0);
+  high_energy_.assign(synth_channels, 0);
+}
 
-  low_filter.resize(synth_channels);
-  mid_filter.resize(synth_channels);
-  high_filter.resize(synth_channels);
-  for (int i = 0; i < mid_filter.size(); i++) {
-    low_filter[i].coefficients = dsp::IIR::Coefficients<float>::makeLowPass(sampleRate, freq_split_lowmid, q);
-    mid_filter[i].get<0>() = dsp::IIR::Coefficients<float>::makeLowPass(sampleRate, freq_split_midhigh, q);
-    mid_filter[i].get<1>() = dsp::IIR::Coefficients<float>::makeHighPass(sampleRate, freq_split_lowmid, q);
-    high_filter[i].coefficients = dsp::IIR::Coefficients<float>::makeLowPass(sampleRate, freq_split_midhigh, q);
+void NewProjectAudioProcessor::update_latency() {
+  size_t latency = 0;
+  if (main_filter_.is_enabled()) {
+    latency += main_filter_.latency_samples();
   }
+  if (loudness_normalizer_.is_enabled()) {
+    latency += loudness_normalizer_.latency_samples();
+  }
+  setLatencySamples(static_cast<int>(latency));
+}
+
+template <typename T>
+const NewProjectAudioProcessor::Chain<T> *NewProjectAudioProcessor::chains() {
+  static constexpr Chain<T> table[] = {
+      make_chain<T, 1, false, false>(), make_chain<T, 1, false, true>(),
+      make_chain<T, 1, true, false>(), make_chain<T, 1, true, true>(),
+      make_chain<T, 2, false, false>(), make_chain<T, 2, false, true>(),
+      make_chain<T, 2, true, false>(), make_chain<T, 2, true, true>(),
+  };
+  return table;
+}
+
+void NewProjectAudioProcessor::update_chain() {
+  size_t layout = synth_channels == 1 ? 0 : 1;
+  size_t filter = main_filter_.is_enabled() ? 1 : 0;
+  size_t input = getTotalNumInputChannels() > 0 ? 1 : 0;
+  chain_ = layout * 4 + filter * 2 + input;
 }
 
 void NewProjectAudioProcessor::releaseResources()
@@ -134,103 +191,105 @@ bool NewProjectAudioProcessor::isBusesLayoutSupported (const BusesLayout& layout
 }
 #endif
 
-template <typename T>
-T calculate_rms(const T *data, size_t size) {
-  double sum = 0;
-  for (size_t i = 0; i < size; i++) {
-    sum += data[i] * data[i];
-  }
-  sum /= size;
-  std::stringstream ss;
-  if (sum > 0) {
-    return static_cast<T>(10.0 * log10(sum));
+static float rms_db(double sum_of_squares, size_t size) {
+  auto mean = sum_of_squares / static_cast<double>(size);
+  if (mean > 0) {
+    return static_cast<float>(10.0 * log10(mean));
   }
   else {
-    return std::numeric_limits<T>::min();
+    return std::numeric_limits<float>::min();
   }
 }
 
+bool NewProjectAudioProcessor::supportsDoublePrecisionProcessing() const {
+  return true;
+}
+
 void NewProjectAudioProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages) {
+  process_block(buffer, midiMessages);
+}
+
+// 64-bit hosts hand their blocks over as they are, every stage runs its own double code
+void NewProjectAudioProcessor::processBlock(AudioBuffer<double>& buffer, MidiBuffer& midiMessages) {
+  process_block(buffer, midiMessages);
+}
+
+template <typename T>
+void NewProjectAudioProcessor::process_block(AudioBuffer<T>& buffer, MidiBuffer& midiMessages) {
   auto t0 = std::chrono::high_resolution_clock::now();
 
   ScopedNoDenormals noDenormals;
-  assert(getTotalNumOutputChannels() == synth_channels);
+  assert(static_cast<size_t>(getTotalNumOutputChannels()) == synth_channels);
 
-  auto editor = dynamic_cast<MainComponent*>(getActiveEditor());
-  if (editor) {
-    auto keyboard_midi = editor->get_keyboard_midi_buffer(getBlockSize());
-    midiMessages.addEvents(keyboard_midi, 0, getBlockSize(), 0);
-  }
+  synth_parameters_.snapshot(synth_snapshot_);
 
-  if (getTotalNumInputChannels() == 0) {
-    buffer.clear();
-    if (synthesiser_.getSampleRate() > 0) {
-      synthesiser_.renderNextBlock(buffer, midiMessages, 0, getBlockSize());
+  auto editor = dynamic_cast<MainComponent*>(getActiveEditor());
+  auto &midi = merge_keyboard_midi(midiMessages);
+
+  // The band meters skip blocks when the governor asks for it. Their filters then resume on
+  //  a signal that moved on, the first samples after a gap are approximate.
+  auto analyse = editor && block_index_++ % analysis_governor_.settings().band_interval == 0;
+  auto &chain = chains<T>()[chain_.load(std::memory_order_relaxed)];
+  auto micro_block = analyse ? chain.analysing : chain.plain;
+  auto num_samples = buffer.getNumSamples();
+  std::fill(input_energy_.begin(), input_energy_.end(), 0.0);
+  std::fill(low_energy_.begin(), low_energy_.end(), 0.0);
+  std::fill(mid_energy_.begin(), mid_energy_.end(), 0.0);
+  std::fill(high_energy_.begin(), high_energy_.end(), 0.0);
+
+  // Events are handed to the synthesiser right before the micro-block that starts at their position
+  MidiBuffer::Iterator midi_iterator(midi);
+  MidiMessage message;
+  int message_position = 0;
+  auto has_message = midi_iterator.getNextEvent(message, message_position);
+  for (int start = 0; start < num_samples;) {
+    while (has_message && message_position <= start) {
+      synthesiser_.handleMidiEvent(message);
+      has_message = midi_iterator.getNextEvent(message, message_position);
     }
-  } else {
-    if (synthesiser_.getSampleRate() > 0) {
-      AudioBuffer<float> synth_buffer(static_cast<int>(synth_channels), getBlockSize());
-      synthesiser_.renderNextBlock(synth_buffer, midiMessages, 0, getBlockSize());
-      for (int i = 0; i < buffer.getNumChannels(); i++) {
-        FloatVectorOperations::add(buffer.getWritePointer(i), synth_buffer.getReadPointer(i), buffer.getNumSamples());
-      }
+    auto end = std::min(start + micro_block_size, num_samples);
+    if (has_message && message_position < end) {
+      end = message_position;
     }
+    (this->*micro_block)(buffer, start, end - start);
+    start = end;
+  }
+  // Events past the end of the block
+  while (has_message) {
+    synthesiser_.handleMidiEvent(message);
+    has_message = midi_iterator.getNextEvent(message, message_position);
   }
 
-  /* RMS calculation. Calculate for the whole block */
   /**
    * midi_input -> synthesizer -> synth_output
    * audio_output = audio_input(if exists) + synth_output
-   * Do synthesis here and add to buffer output_buffer
    */
-
-  // Apply filters
-  if (editor) {
-    std::vector<float> rms;
-    rms.reserve(synth_channels);
-    for (int channel = 0; channel < synth_channels; ++channel) {
-      rms.push_back(calculate_rms(buffer.getArrayOfReadPointers()[channel], getBlockSize()));
-    }
-    editor->set_input_rms(rms);
-    std::stringstream mid_rms, low_rms, high_rms;
+  if (analyse) {
     for (int channel = 0; channel < synth_channels; channel++) {
-      if (editor->is_main_filter_enabled()) {
-        AudioBuffer<float> audio_buffer_main(1, getBlockSize());
-        audio_buffer_main.copyFrom(0, 0, buffer, channel, 0, getBlockSize());
-        dsp::AudioBlock<float> audio_block_main(audio_buffer_main);
-        dsp::ProcessContextReplacing<float> replacing_context_main(audio_block_main);
-        editor->filter_process(channel, replacing_context_main);
-        buffer.copyFrom(channel, 0, audio_buffer_main, 0, 0, getBlockSize());
-      }
-
-      AudioBuffer<float> audio_buffer_filter(1, getBlockSize());
-      audio_buffer_filter.copyFrom(0, 0, buffer, channel, 0, getBlockSize());
-      dsp::AudioBlock<float> audio_block_filter(audio_buffer_filter);
-      dsp::ProcessContextReplacing<float> replacing_context(audio_block_filter);
-      mid_filter[channel].process(replacing_context);
-      auto channel_rms = calculate_rms(audio_buffer_filter.getArrayOfReadPointers()[0], getBlockSize());
-      mid_rms << std::fixed << std::setprecision(2) << channel_rms << "dB ";
-
-      audio_buffer_filter.copyFrom(0, 0, buffer, channel, 0, getBlockSize());
-      low_filter[channel].process(replacing_context);
-      channel_rms = calculate_rms(audio_buffer_filter.getArrayOfReadPointers()[0], getBlockSize());
-      low_rms << std::fixed << std::setprecision(2) << channel_rms << "dB ";
-
-      audio_buffer_filter.copyFrom(0, 0, buffer, channel, 0, getBlockSize());
-      high_filter[channel].process(replacing_context);
-      channel_rms = calculate_rms(audio_buffer_filter.getArrayOfReadPointers()[0], getBlockSize());
-      high_rms << std::fixed << std::setprecision(2) << channel_rms << "dB ";
+      metrics_.set(MetricInputRms, channel, rms_db(input_energy_[channel], static_cast<size_t>(num_samples)));
+      metrics_.set(MetricOutputLowRms, channel, rms_db(low_energy_[channel], static_cast<size_t>(num_samples)));
+      metrics_.set(MetricOutputMidRms, channel, rms_db(mid_energy_[channel], static_cast<size_t>(num_samples)));
+      metrics_.set(MetricOutputHighRms, channel, rms_db(high_energy_[channel], static_cast<size_t>(num_samples)));
     }
-    editor->add_display_value("Output Low RMS", low_rms.str());
-    editor->add_display_value("Output Mid RMS", mid_rms.str());
-    editor->add_display_value("Output High RMS", high_rms.str());
+  }
+  if (editor) {
+    metrics_.set(MetricLoudness, 0, loudness_normalizer_.short_term_loudness());
+    metrics_.set(MetricLoudness, 1, loudness_normalizer_.is_enabled() ? loudness_normalizer_.gain_db() : 0);
+    metrics_.set(MetricLoudness, 2, loudness_normalizer_.is_enabled() ? loudness_normalizer_.limiter_gain_db() : 0);
 
     // Calculate latency
     auto callback_interval = std::chrono::duration<float>(t0 - last_process_time).count();
-    editor->set_process_block_interval(callback_interval);
+    metrics_.set(MetricLatency, 0, callback_interval * 1000);
     last_process_time = t0;
 
-    editor->send_block(static_cast<float>(getSampleRate()), buffer);
+    if constexpr (std::is_same_v<T, float>) {
+      editor->send_block(static_cast<float>(getSampleRate()), buffer);
+    } else {
+      // The editor analyses in float, and copies the block anyway
+      AudioBuffer<float> block;
+      block.makeCopyOf(buffer);
+      editor->send_block(static_cast<float>(getSampleRate()), std::move(block));
+    }
   }
 
   auto t1 = std::chrono::high_resolution_clock::now();
@@ -240,9 +299,79 @@ void NewProjectAudioProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuff
     late_block_count_++;
   }
 
-  if (editor) {
-    editor->set_latency_ms(total_latency.count() * 1000, max_latency_expected * 1000, late_block_count_);
+  analysis_governor_.add_block(total_latency.count(), num_samples / getSampleRate());
+  metrics_.set(MetricAnalysis, 0, static_cast<float>(analysis_governor_.tier()));
+  metrics_.set(MetricAnalysis, 1, analysis_governor_.load());
+
+  metrics_.set(MetricLatency, 1, total_latency.count() * 1000);
+  metrics_.set(MetricLatency, 2, max_latency_expected * 1000);
+  metrics_.set(MetricLateBlocks, static_cast<float>(late_block_count_));
+  metrics_.set(MetricVoices, 0, static_cast<float>(synthesiser_.active_voice_count()));
+  metrics_.set(MetricVoices, 1, static_cast<float>(synthesiser_.stolen_voice_count()));
+}
+
+const MidiBuffer &NewProjectAudioProcessor::merge_keyboard_midi(const MidiBuffer &host_midi) {
+  merged_midi_.clear();
+  if (!keyboard_midi_.drain_into(merged_midi_, 0)) {
+    return host_midi;
+  }
+  // Host events at the same position go after the keyboard events
+  merged_midi_.addEvents(host_midi, 0, -1, 0);
+  return merged_midi_;
+}
+
+template <typename T, size_t Channels, bool Filter, bool Input, bool Analysis>
+void NewProjectAudioProcessor::process_micro_block(AudioBuffer<T> &buffer, int start_sample, int num_samples) {
+  const size_t channels = Channels;
+  auto &scratch = buffers<T>();
+  auto &micro_buffer = scratch.micro_buffer;
+  auto &band_buffer = scratch.band_buffer;
+  auto samples = static_cast<size_t>(num_samples);
+  for_each_channel<Channels>([&](size_t channel) {
+    if constexpr (Input) {
+      micro_buffer.copyFrom(static_cast<int>(channel), 0, buffer, static_cast<int>(channel), start_sample, num_samples);
+    } else {
+      micro_buffer.clear(static_cast<int>(channel), 0, num_samples);
+    }
+  });
+  if (synthesiser_.getSampleRate() > 0) {
+    // All events were already handled, this only renders. Voices mix into T.
+    synthesiser_.renderNextBlock(micro_buffer, no_midi_, 0, num_samples);
   }
+
+  if constexpr (Analysis) {
+    for_each_channel<Channels>([&](size_t channel) {
+      input_energy_[channel] += sum_of_squares(micro_buffer.getReadPointer(static_cast<int>(channel)), samples);
+    });
+  }
+  if constexpr (Filter) {
+    main_filter_.process(micro_buffer.getArrayOfWritePointers(), channels, samples);
+  }
+  loudness_normalizer_.process(micro_buffer.getArrayOfWritePointers(), channels, samples);
+
+  // Band analysis
+  if constexpr (Analysis) {
+    dsp::AudioBlock<T> band_block = dsp::AudioBlock<T>(band_buffer).getSubBlock(0, samples);
+    dsp::ProcessContextReplacing<T> band_context(band_block);
+    for_each_channel<Channels>([&](size_t channel) {
+      auto source = static_cast<int>(channel);
+      band_buffer.copyFrom(0, 0, micro_buffer, source, 0, num_samples);
+      scratch.mid_filter[channel].process(band_context);
+      mid_energy_[channel] += sum_of_squares(band_buffer.getReadPointer(0), samples);
+
+      band_buffer.copyFrom(0, 0, micro_buffer, source, 0, num_samples);
+      scratch.low_filter[channel].process(band_context);
+      low_energy_[channel] += sum_of_squares(band_buffer.getReadPointer(0), samples);
+
+      band_buffer.copyFrom(0, 0, micro_buffer, source, 0, num_samples);
+      scratch.high_filter[channel].process(band_context);
+      high_energy_[channel] += sum_of_squares(band_buffer.getReadPointer(0), samples);
+    });
+  }
+
+  for_each_channel<Channels>([&](size_t channel) {
+    buffer.copyFrom(static_cast<int>(channel), start_sample, micro_buffer, static_cast<int>(channel), 0, num_samples);
+  });
 }
 
 //==============================================================================
@@ -1,9 +1,65 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include <type_traits>
 #include "loudmon/filter_ui.h"
+#include "loudmon/main_filter.h"
+#include "loudmon/loudness.h"
+#include "loudmon/analysis_governor.h"
 #include "synth/synth.h"
+#include "synth/keyboard_midi_queue.h"
+#include "common/metric_registry.h"
 
+// Metrics shown in the info panel, in display order
+enum Metric : size_t {
+  MetricFps,
+  // out(callback interval)/in(processing time)/max expected
+  MetricLatency,
+  MetricLateBlocks,
+  // active/stolen
+  MetricVoices,
+  MetricSampleRate,
+  MetricSamplesPerBlock,
+  MetricInputChannels,
+  MetricInputRms,
+  MetricOutputLowRms,
+  MetricOutputMidRms,
+  MetricOutputHighRms,
+  MetricOutputPeak,
+  // short-term/normalization gain/limiter gain
+  MetricLoudness,
+  MetricEntropy,
+  // tier/load
+  MetricAnalysis,
+  // latency/size/loss/coalesced
+  MetricUIQueue,
+  MetricUIProcessingLatency,
+  MetricCount
+};
+
+
+// What processing needs for one sample type, hosts choose float or double
+template <typename T>
+struct SampleTypeBuffers {
+  void prepare(double sample_rate, size_t channels, int max_block, T split_lowmid, T split_midhigh, T q) {
+    micro_buffer.setSize(static_cast<int>(channels), max_block);
+    band_buffer.setSize(1, max_block);
+    low_filter.resize(channels);
+    mid_filter.resize(channels);
+    high_filter.resize(channels);
+    for (size_t i = 0; i < channels; i++) {
+      low_filter[i].coefficients = dsp::IIR::Coefficients<T>::makeLowPass(sample_rate, split_lowmid, q);
+      mid_filter[i].template get<0>() = dsp::IIR::Coefficients<T>::makeLowPass(sample_rate, split_midhigh, q);
+      mid_filter[i].template get<1>() = dsp::IIR::Coefficients<T>::makeHighPass(sample_rate, split_lowmid, q);
+      high_filter[i].coefficients = dsp::IIR::Coefficients<T>::makeLowPass(sample_rate, split_midhigh, q);
+    }
+  }
+
+  AudioBuffer<T> micro_buffer;
+  AudioBuffer<T> band_buffer;
+  std::vector<dsp::IIR::Filter<T>> low_filter, high_filter;
+  std::vector<PeakFilter<T>> mid_filter;
+};
 
 class MainComponent;
 class NewProjectAudioProcessor  : public AudioProcessor {
@@ -21,6 +77,8 @@ class NewProjectAudioProcessor  : public AudioProcessor {
 #endif
 
   void processBlock(AudioBuffer<float>&, MidiBuffer&) override;
+  void processBlock(AudioBuffer<double>&, MidiBuffer&) override;
+  bool supportsDoublePrecisionProcessing() const override;
 
   AudioProcessorEditor* createEditor() override;
   bool hasEditor() const override;
@@ -41,18 +99,106 @@ class NewProjectAudioProcessor  : public AudioProcessor {
   void getStateInformation (MemoryBlock& destData) override;
   void setStateInformation (const void* data, int sizeInBytes) override;
 
+  MetricRegistry &get_metrics() {
+    return metrics_;
+  }
+  SynthParameters &get_synth_parameters() {
+    return synth_parameters_;
+  }
+  // The editor's keyboard state reports to this
+  KeyboardMidiQueue &get_keyboard_midi() {
+    return keyboard_midi_;
+  }
+  MainFilter &get_main_filter() {
+    return main_filter_;
+  }
+  LoudnessNormalizer &get_loudness_normalizer() {
+    return loudness_normalizer_;
+  }
+  const AnalysisGovernor &get_analysis_governor() const {
+    return analysis_governor_;
+  }
+  // Reports the delay of the main filter and the normalizer to the host, after either was switched.
+  //  Not on the audio thread.
+  void update_latency();
+  // Picks the processing chain for the output channel count, the input and the main filter switch.
+  //  After the main filter was switched, not on the audio thread.
+  void update_chain();
+
+ private:
+  void register_metrics();
+  template <typename T>
+  void process_block(AudioBuffer<T> &buffer, MidiBuffer &midi_messages);
+  // Synthesis, filters and analysis of one micro-block, on the scratch buffer. Compiled for every
+  //  configuration, so that nothing in it is decided per channel or per sample: Channels is the
+  //  channel count, 1 or 2 as isBusesLayoutSupported allows; Filter runs the main filter; Input
+  //  mixes the host's input, synth-only hosts have none; Analysis feeds the editor's meters.
+  template <typename T, size_t Channels, bool Filter, bool Input, bool Analysis>
+  void process_micro_block(AudioBuffer<T> &buffer, int start_sample, int num_samples);
+  template <typename T>
+  using MicroBlockFunction = void (NewProjectAudioProcessor::*)(AudioBuffer<T> &, int, int);
+  // One configuration, the editor may open or close at any block
+  template <typename T>
+  struct Chain {
+    MicroBlockFunction<T> plain, analysing;
+  };
+  template <typename T, size_t Channels, bool Filter, bool Input>
+  static constexpr Chain<T> make_chain() {
+    return {&NewProjectAudioProcessor::process_micro_block<T, Channels, Filter, Input, false>,
+            &NewProjectAudioProcessor::process_micro_block<T, Channels, Filter, Input, true>};
+  }
+  // Indexed by chain_
+  template <typename T>
+  static const Chain<T> *chains();
+  template <typename T>
+  SampleTypeBuffers<T> &buffers() {
+    if constexpr (std::is_same_v<T, double>) {
+      return double_buffers_;
+    } else {
+      return float_buffers_;
+    }
+  }
+  // The host's events, plus the keyboard events at the start of the block if there are any
+  const MidiBuffer &merge_keyboard_midi(const MidiBuffer &host_midi);
+
  private:
+  MetricRegistry metrics_;
   std::vector<std::vector<float>> loudness_buffer;
   AudioBuffer<float> synth_output_buffer;
+  // Of the output bus, set in prepareToPlay
   size_t synth_channels = 2;
+  // isBusesLayoutSupported takes mono and stereo, per channel metrics are registered for this many
+  static constexpr size_t max_synth_channels = 2;
   std::chrono::high_resolution_clock::time_point last_process_time;
   size_t late_block_count_ = 0;
-  MPESynthesiser synthesiser_;
+  SynthParameters synth_parameters_;
+  // Taken at the start of every block, voices only read this
+  SynthParameterSnapshot synth_snapshot_;
+  VoiceBankSynthesiser synthesiser_ = VoiceBankSynthesiser(&synth_snapshot_, 128);
+
+  // Host blocks are processed in micro-blocks of at most this many samples, cut at every MIDI event.
+  //  Events are sample accurate and the working set stays in L1 whatever the host block size.
+  static constexpr int micro_block_size = 32;
+  SampleTypeBuffers<float> float_buffers_;
+  SampleTypeBuffers<double> double_buffers_;
+  // [mono, stereo][main filter off, on][synth only, input]
+  std::atomic<size_t> chain_ = 0;
+  MidiBuffer no_midi_;
+
+  KeyboardMidiQueue keyboard_midi_;
+  // Reserved in prepareToPlay, so that merging does not allocate for any sensible amount of events
+  MidiBuffer merged_midi_;
+  static constexpr int merged_midi_reserved_bytes = 16 << 10;
+  // Sums of squares over the current host block, per channel
+  std::vector<double> input_energy_, low_energy_, mid_energy_, high_energy_;
+  AnalysisGovernor analysis_governor_;
+  // Host blocks since prepareToPlay, for the band meter interval
+  size_t block_index_ = 0;
 
+  MainFilter main_filter_;
+  LoudnessNormalizer loudness_normalizer_;
   float freq_split_lowmid = 200, freq_split_midhigh = 2000;
   float q = 0.1f;
-  std::vector<dsp::IIR::Filter<float>> low_filter, high_filter;
-  std::vector<PeakFilter<float>> mid_filter;
   //==============================================================================
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (NewProjectAudioProcessor)
 };
@@ -0,0 +1,663 @@
+#include "meter_kernels.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <JuceHeader.h>
+
+#if JUCE_INTEL
+ #include <immintrin.h>
+#elif defined(__aarch64__)
+ #include <arm_neon.h>
+#endif
+
+// GCC and clang only emit instructions the function is marked for, MSVC emits any intrinsic
+#if JUCE_INTEL && !JUCE_MSVC
+ #define METER_TARGET(isa) __attribute__((target(isa)))
+#else
+ #define METER_TARGET(isa)
+#endif
+
+namespace {
+
+constexpr float Sqrt2 = 1.41421356f;
+constexpr float Ln2 = 0.693147181f;
+constexpr float Ln10 = 2.30258509f;
+
+/* Scalar reference, and the tails of the SIMD versions */
+
+double sum_of_squares_scalar(const float *data, size_t size) {
+  double sum = 0;
+  for (size_t i = 0; i < size; i++) {
+    auto x = static_cast<double>(data[i]);
+    sum += x * x;
+  }
+  return sum;
+}
+
+double sum_of_squares_double_scalar(const double *data, size_t size) {
+  double sum = 0;
+  for (size_t i = 0; i < size; i++) {
+    sum += data[i] * data[i];
+  }
+  return sum;
+}
+
+MinMax min_max_scalar(const float *data, size_t size) {
+  MinMax result{data[0], data[0]};
+  for (size_t i = 1; i < size; i++) {
+    result.min = std::min(result.min, data[i]);
+    result.max = std::max(result.max, data[i]);
+  }
+  return result;
+}
+
+float abs_peak_scalar(const float *data, size_t size) {
+  float peak = 0;
+  for (size_t i = 0; i < size; i++) {
+    peak = std::max(peak, std::abs(data[i]));
+  }
+  return peak;
+}
+
+// Written so that NaN goes to 0, as the SIMD max instructions send it
+inline size_t bin_index(float x, float offset, float scale, float top) {
+  auto v = (x + offset) * scale;
+  v = v > 0 ? v : 0;
+  v = v < top ? v : top;
+  return static_cast<size_t>(v);
+}
+
+void histogram_scalar(const float *data, size_t size, float offset, float scale, size_t *bins, size_t bin_count) {
+  auto top = static_cast<float>(bin_count - 1);
+  for (size_t i = 0; i < size; i++) {
+    bins[bin_index(data[i], offset, scale, top)]++;
+  }
+}
+
+inline float clamp_positive(float x) {
+  x = x > FLT_MIN ? x : FLT_MIN;
+  return x < FLT_MAX ? x : FLT_MAX;
+}
+
+void to_db_scalar(const float *in, float *out, size_t size, float multiplier, float floor) {
+  for (size_t i = 0; i < size; i++) {
+    out[i] = std::max(multiplier * std::log10(clamp_positive(in[i])), floor);
+  }
+}
+
+/* The SIMD logarithms split x into 2^e * m with m in [sqrt(1/2), sqrt(2)), then
+ *  ln(m) = 2 atanh(s) = 2 (s + s^3/3 + s^5/5 + ...), s = (m - 1) / (m + 1). |s| < 0.172, so five
+ *  terms are exact to float precision. */
+
+#if JUCE_INTEL
+
+/* SSE2 */
+
+METER_TARGET("sse2") __m128 log_sse2(__m128 x) {
+  auto bits = _mm_castps_si128(x);
+  auto exponent = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+  auto m = _mm_or_ps(_mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x007fffff))), _mm_set1_ps(1));
+  auto above = _mm_cmpgt_ps(m, _mm_set1_ps(Sqrt2));
+  m = _mm_sub_ps(m, _mm_and_ps(above, _mm_mul_ps(m, _mm_set1_ps(0.5f))));
+  // All ones is -1
+  exponent = _mm_sub_epi32(exponent, _mm_castps_si128(above));
+
+  auto s = _mm_div_ps(_mm_sub_ps(m, _mm_set1_ps(1)), _mm_add_ps(m, _mm_set1_ps(1)));
+  auto s2 = _mm_mul_ps(s, s);
+  auto series = _mm_add_ps(_mm_set1_ps(1.0f / 7), _mm_mul_ps(s2, _mm_set1_ps(1.0f / 9)));
+  series = _mm_add_ps(_mm_set1_ps(1.0f / 5), _mm_mul_ps(s2, series));
+  series = _mm_add_ps(_mm_set1_ps(1.0f / 3), _mm_mul_ps(s2, series));
+  series = _mm_add_ps(_mm_set1_ps(1), _mm_mul_ps(s2, series));
+  auto ln_m = _mm_mul_ps(_mm_add_ps(s, s), series);
+  return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(exponent), _mm_set1_ps(Ln2)), ln_m);
+}
+
+METER_TARGET("sse2") double sum_of_squares_sse2(const float *data, size_t size) {
+  auto sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto x = _mm_loadu_ps(data + i);
+    auto low = _mm_cvtps_pd(x);
+    auto high = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+    sum0 = _mm_add_pd(sum0, _mm_mul_pd(low, low));
+    sum1 = _mm_add_pd(sum1, _mm_mul_pd(high, high));
+  }
+  alignas(16) double lanes[2];
+  _mm_store_pd(lanes, _mm_add_pd(sum0, sum1));
+  return lanes[0] + lanes[1] + sum_of_squares_scalar(data + i, size - i);
+}
+
+METER_TARGET("sse2") double sum_of_squares_double_sse2(const double *data, size_t size) {
+  auto sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto x0 = _mm_loadu_pd(data + i);
+    auto x1 = _mm_loadu_pd(data + i + 2);
+    sum0 = _mm_add_pd(sum0, _mm_mul_pd(x0, x0));
+    sum1 = _mm_add_pd(sum1, _mm_mul_pd(x1, x1));
+  }
+  alignas(16) double lanes[2];
+  _mm_store_pd(lanes, _mm_add_pd(sum0, sum1));
+  return lanes[0] + lanes[1] + sum_of_squares_double_scalar(data + i, size - i);
+}
+
+METER_TARGET("sse2") MinMax min_max_sse2(const float *data, size_t size) {
+  if (size < 4) {
+    return min_max_scalar(data, size);
+  }
+  auto low = _mm_loadu_ps(data), high = low;
+  size_t i = 4;
+  for (; i + 4 <= size; i += 4) {
+    auto x = _mm_loadu_ps(data + i);
+    low = _mm_min_ps(low, x);
+    high = _mm_max_ps(high, x);
+  }
+  alignas(16) float lows[4], highs[4];
+  _mm_store_ps(lows, low);
+  _mm_store_ps(highs, high);
+  MinMax result{*std::min_element(lows, lows + 4), *std::max_element(highs, highs + 4)};
+  for (; i < size; i++) {
+    result.min = std::min(result.min, data[i]);
+    result.max = std::max(result.max, data[i]);
+  }
+  return result;
+}
+
+METER_TARGET("sse2") float abs_peak_sse2(const float *data, size_t size) {
+  auto magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  auto peak = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    peak = _mm_max_ps(peak, _mm_and_ps(_mm_loadu_ps(data + i), magnitude));
+  }
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, peak);
+  return std::max(*std::max_element(lanes, lanes + 4), abs_peak_scalar(data + i, size - i));
+}
+
+METER_TARGET("sse2") void histogram_sse2(const float *data, size_t size, float offset, float scale, size_t *bins, size_t bin_count) {
+  auto offsets = _mm_set1_ps(offset), scales = _mm_set1_ps(scale);
+  auto zero = _mm_setzero_ps(), top = _mm_set1_ps(static_cast<float>(bin_count - 1));
+  alignas(16) int32_t indices[4];
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto v = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(data + i), offsets), scales);
+    v = _mm_min_ps(_mm_max_ps(v, zero), top);
+    _mm_store_si128(reinterpret_cast<__m128i *>(indices), _mm_cvttps_epi32(v));
+    // Increments stay scalar, neighbouring samples often land in the same bin
+    for (auto index : indices) {
+      bins[index]++;
+    }
+  }
+  histogram_scalar(data + i, size - i, offset, scale, bins, bin_count);
+}
+
+METER_TARGET("sse2") void to_db_sse2(const float *in, float *out, size_t size, float multiplier, float floor) {
+  auto factor = _mm_set1_ps(multiplier / Ln10), floors = _mm_set1_ps(floor);
+  auto smallest = _mm_set1_ps(FLT_MIN), largest = _mm_set1_ps(FLT_MAX);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), smallest), largest);
+    _mm_storeu_ps(out + i, _mm_max_ps(_mm_mul_ps(log_sse2(x), factor), floors));
+  }
+  to_db_scalar(in + i, out + i, size - i, multiplier, floor);
+}
+
+/* AVX2 */
+
+METER_TARGET("avx2") __m256 log_avx2(__m256 x) {
+  auto bits = _mm256_castps_si256(x);
+  auto exponent = _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127));
+  auto m = _mm256_or_ps(_mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x007fffff))), _mm256_set1_ps(1));
+  auto above = _mm256_cmp_ps(m, _mm256_set1_ps(Sqrt2), _CMP_GT_OQ);
+  m = _mm256_sub_ps(m, _mm256_and_ps(above, _mm256_mul_ps(m, _mm256_set1_ps(0.5f))));
+  exponent = _mm256_sub_epi32(exponent, _mm256_castps_si256(above));
+
+  auto s = _mm256_div_ps(_mm256_sub_ps(m, _mm256_set1_ps(1)), _mm256_add_ps(m, _mm256_set1_ps(1)));
+  auto s2 = _mm256_mul_ps(s, s);
+  auto series = _mm256_add_ps(_mm256_set1_ps(1.0f / 7), _mm256_mul_ps(s2, _mm256_set1_ps(1.0f / 9)));
+  series = _mm256_add_ps(_mm256_set1_ps(1.0f / 5), _mm256_mul_ps(s2, series));
+  series = _mm256_add_ps(_mm256_set1_ps(1.0f / 3), _mm256_mul_ps(s2, series));
+  series = _mm256_add_ps(_mm256_set1_ps(1), _mm256_mul_ps(s2, series));
+  auto ln_m = _mm256_mul_ps(_mm256_add_ps(s, s), series);
+  return _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(exponent), _mm256_set1_ps(Ln2)), ln_m);
+}
+
+METER_TARGET("avx2") double sum_of_squares_avx2(const float *data, size_t size) {
+  auto sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    auto low = _mm256_cvtps_pd(_mm_loadu_ps(data + i));
+    auto high = _mm256_cvtps_pd(_mm_loadu_ps(data + i + 4));
+    sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(low, low));
+    sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(high, high));
+  }
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, _mm256_add_pd(sum0, sum1));
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_of_squares_scalar(data + i, size - i);
+}
+
+METER_TARGET("avx2") double sum_of_squares_double_avx2(const double *data, size_t size) {
+  auto sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    auto x0 = _mm256_loadu_pd(data + i);
+    auto x1 = _mm256_loadu_pd(data + i + 4);
+    sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(x0, x0));
+    sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(x1, x1));
+  }
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, _mm256_add_pd(sum0, sum1));
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_of_squares_double_scalar(data + i, size - i);
+}
+
+METER_TARGET("avx2") MinMax min_max_avx2(const float *data, size_t size) {
+  if (size < 8) {
+    return min_max_scalar(data, size);
+  }
+  auto low = _mm256_loadu_ps(data), high = low;
+  size_t i = 8;
+  for (; i + 8 <= size; i += 8) {
+    auto x = _mm256_loadu_ps(data + i);
+    low = _mm256_min_ps(low, x);
+    high = _mm256_max_ps(high, x);
+  }
+  alignas(32) float lows[8], highs[8];
+  _mm256_store_ps(lows, low);
+  _mm256_store_ps(highs, high);
+  MinMax result{*std::min_element(lows, lows + 8), *std::max_element(highs, highs + 8)};
+  for (; i < size; i++) {
+    result.min = std::min(result.min, data[i]);
+    result.max = std::max(result.max, data[i]);
+  }
+  return result;
+}
+
+METER_TARGET("avx2") float abs_peak_avx2(const float *data, size_t size) {
+  auto magnitude = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  auto peak = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    peak = _mm256_max_ps(peak, _mm256_and_ps(_mm256_loadu_ps(data + i), magnitude));
+  }
+  alignas(32) float lanes[8];
+  _mm256_store_ps(lanes, peak);
+  return std::max(*std::max_element(lanes, lanes + 8), abs_peak_scalar(data + i, size - i));
+}
+
+METER_TARGET("avx2") void histogram_avx2(const float *data, size_t size, float offset, float scale, size_t *bins, size_t bin_count) {
+  auto offsets = _mm256_set1_ps(offset), scales = _mm256_set1_ps(scale);
+  auto zero = _mm256_setzero_ps(), top = _mm256_set1_ps(static_cast<float>(bin_count - 1));
+  alignas(32) int32_t indices[8];
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    auto v = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(data + i), offsets), scales);
+    v = _mm256_min_ps(_mm256_max_ps(v, zero), top);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(indices), _mm256_cvttps_epi32(v));
+    for (auto index : indices) {
+      bins[index]++;
+    }
+  }
+  histogram_scalar(data + i, size - i, offset, scale, bins, bin_count);
+}
+
+METER_TARGET("avx2") void to_db_avx2(const float *in, float *out, size_t size, float multiplier, float floor) {
+  auto factor = _mm256_set1_ps(multiplier / Ln10), floors = _mm256_set1_ps(floor);
+  auto smallest = _mm256_set1_ps(FLT_MIN), largest = _mm256_set1_ps(FLT_MAX);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    auto x = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), smallest), largest);
+    _mm256_storeu_ps(out + i, _mm256_max_ps(_mm256_mul_ps(log_avx2(x), factor), floors));
+  }
+  to_db_scalar(in + i, out + i, size - i, multiplier, floor);
+}
+
+/* AVX-512 */
+
+METER_TARGET("avx512f") __m512 log_avx512(__m512 x) {
+  auto bits = _mm512_castps_si512(x);
+  auto exponent = _mm512_sub_epi32(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(127));
+  auto m = _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007fffff)),
+                                               _mm512_castps_si512(_mm512_set1_ps(1))));
+  auto above = _mm512_cmp_ps_mask(m, _mm512_set1_ps(Sqrt2), _CMP_GT_OQ);
+  m = _mm512_mask_mul_ps(m, above, m, _mm512_set1_ps(0.5f));
+  exponent = _mm512_mask_add_epi32(exponent, above, exponent, _mm512_set1_epi32(1));
+
+  auto s = _mm512_div_ps(_mm512_sub_ps(m, _mm512_set1_ps(1)), _mm512_add_ps(m, _mm512_set1_ps(1)));
+  auto s2 = _mm512_mul_ps(s, s);
+  auto series = _mm512_add_ps(_mm512_set1_ps(1.0f / 7), _mm512_mul_ps(s2, _mm512_set1_ps(1.0f / 9)));
+  series = _mm512_add_ps(_mm512_set1_ps(1.0f / 5), _mm512_mul_ps(s2, series));
+  series = _mm512_add_ps(_mm512_set1_ps(1.0f / 3), _mm512_mul_ps(s2, series));
+  series = _mm512_add_ps(_mm512_set1_ps(1), _mm512_mul_ps(s2, series));
+  auto ln_m = _mm512_mul_ps(_mm512_add_ps(s, s), series);
+  return _mm512_add_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(exponent), _mm512_set1_ps(Ln2)), ln_m);
+}
+
+METER_TARGET("avx512f") double sum_of_squares_avx512(const float *data, size_t size) {
+  auto sum0 = _mm512_setzero_pd(), sum1 = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto low = _mm512_cvtps_pd(_mm256_loadu_ps(data + i));
+    auto high = _mm512_cvtps_pd(_mm256_loadu_ps(data + i + 8));
+    sum0 = _mm512_add_pd(sum0, _mm512_mul_pd(low, low));
+    sum1 = _mm512_add_pd(sum1, _mm512_mul_pd(high, high));
+  }
+  return _mm512_reduce_add_pd(_mm512_add_pd(sum0, sum1)) + sum_of_squares_scalar(data + i, size - i);
+}
+
+METER_TARGET("avx512f") double sum_of_squares_double_avx512(const double *data, size_t size) {
+  auto sum0 = _mm512_setzero_pd(), sum1 = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto x0 = _mm512_loadu_pd(data + i);
+    auto x1 = _mm512_loadu_pd(data + i + 8);
+    sum0 = _mm512_add_pd(sum0, _mm512_mul_pd(x0, x0));
+    sum1 = _mm512_add_pd(sum1, _mm512_mul_pd(x1, x1));
+  }
+  return _mm512_reduce_add_pd(_mm512_add_pd(sum0, sum1)) + sum_of_squares_double_scalar(data + i, size - i);
+}
+
+METER_TARGET("avx512f") MinMax min_max_avx512(const float *data, size_t size) {
+  if (size < 16) {
+    return min_max_scalar(data, size);
+  }
+  auto low = _mm512_loadu_ps(data), high = low;
+  size_t i = 16;
+  for (; i + 16 <= size; i += 16) {
+    auto x = _mm512_loadu_ps(data + i);
+    low = _mm512_min_ps(low, x);
+    high = _mm512_max_ps(high, x);
+  }
+  MinMax result{_mm512_reduce_min_ps(low), _mm512_reduce_max_ps(high)};
+  for (; i < size; i++) {
+    result.min = std::min(result.min, data[i]);
+    result.max = std::max(result.max, data[i]);
+  }
+  return result;
+}
+
+METER_TARGET("avx512f") float abs_peak_avx512(const float *data, size_t size) {
+  auto peak = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    peak = _mm512_max_ps(peak, _mm512_abs_ps(_mm512_loadu_ps(data + i)));
+  }
+  return std::max(_mm512_reduce_max_ps(peak), abs_peak_scalar(data + i, size - i));
+}
+
+METER_TARGET("avx512f") void histogram_avx512(const float *data, size_t size, float offset, float scale, size_t *bins, size_t bin_count) {
+  auto offsets = _mm512_set1_ps(offset), scales = _mm512_set1_ps(scale);
+  auto zero = _mm512_setzero_ps(), top = _mm512_set1_ps(static_cast<float>(bin_count - 1));
+  alignas(64) int32_t indices[16];
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto v = _mm512_mul_ps(_mm512_add_ps(_mm512_loadu_ps(data + i), offsets), scales);
+    v = _mm512_min_ps(_mm512_max_ps(v, zero), top);
+    _mm512_store_si512(indices, _mm512_cvttps_epi32(v));
+    for (auto index : indices) {
+      bins[index]++;
+    }
+  }
+  histogram_scalar(data + i, size - i, offset, scale, bins, bin_count);
+}
+
+METER_TARGET("avx512f") void to_db_avx512(const float *in, float *out, size_t size, float multiplier, float floor) {
+  auto factor = _mm512_set1_ps(multiplier / Ln10), floors = _mm512_set1_ps(floor);
+  auto smallest = _mm512_set1_ps(FLT_MIN), largest = _mm512_set1_ps(FLT_MAX);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto x = _mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(in + i), smallest), largest);
+    _mm512_storeu_ps(out + i, _mm512_max_ps(_mm512_mul_ps(log_avx512(x), factor), floors));
+  }
+  to_db_scalar(in + i, out + i, size - i, multiplier, floor);
+}
+
+#elif defined(__aarch64__)
+
+/* NEON, part of every AArch64 CPU */
+
+float32x4_t log_neon(float32x4_t x) {
+  auto bits = vreinterpretq_s32_f32(x);
+  auto exponent = vsubq_s32(vshrq_n_s32(bits, 23), vdupq_n_s32(127));
+  auto m = vreinterpretq_f32_s32(vorrq_s32(vandq_s32(bits, vdupq_n_s32(0x007fffff)),
+                                           vreinterpretq_s32_f32(vdupq_n_f32(1))));
+  auto above = vcgtq_f32(m, vdupq_n_f32(Sqrt2));
+  m = vbslq_f32(above, vmulq_f32(m, vdupq_n_f32(0.5f)), m);
+  // All ones is -1
+  exponent = vsubq_s32(exponent, vreinterpretq_s32_u32(above));
+
+  auto s = vdivq_f32(vsubq_f32(m, vdupq_n_f32(1)), vaddq_f32(m, vdupq_n_f32(1)));
+  auto s2 = vmulq_f32(s, s);
+  auto series = vaddq_f32(vdupq_n_f32(1.0f / 7), vmulq_f32(s2, vdupq_n_f32(1.0f / 9)));
+  series = vaddq_f32(vdupq_n_f32(1.0f / 5), vmulq_f32(s2, series));
+  series = vaddq_f32(vdupq_n_f32(1.0f / 3), vmulq_f32(s2, series));
+  series = vaddq_f32(vdupq_n_f32(1), vmulq_f32(s2, series));
+  auto ln_m = vmulq_f32(vaddq_f32(s, s), series);
+  return vaddq_f32(vmulq_f32(vcvtq_f32_s32(exponent), vdupq_n_f32(Ln2)), ln_m);
+}
+
+double sum_of_squares_neon(const float *data, size_t size) {
+  auto sum0 = vdupq_n_f64(0), sum1 = vdupq_n_f64(0);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto x = vld1q_f32(data + i);
+    auto low = vcvt_f64_f32(vget_low_f32(x));
+    auto high = vcvt_high_f64_f32(x);
+    sum0 = vaddq_f64(sum0, vmulq_f64(low, low));
+    sum1 = vaddq_f64(sum1, vmulq_f64(high, high));
+  }
+  return vaddvq_f64(vaddq_f64(sum0, sum1)) + sum_of_squares_scalar(data + i, size - i);
+}
+
+double sum_of_squares_double_neon(const double *data, size_t size) {
+  auto sum0 = vdupq_n_f64(0), sum1 = vdupq_n_f64(0);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto x0 = vld1q_f64(data + i);
+    auto x1 = vld1q_f64(data + i + 2);
+    sum0 = vaddq_f64(sum0, vmulq_f64(x0, x0));
+    sum1 = vaddq_f64(sum1, vmulq_f64(x1, x1));
+  }
+  return vaddvq_f64(vaddq_f64(sum0, sum1)) + sum_of_squares_double_scalar(data + i, size - i);
+}
+
+MinMax min_max_neon(const float *data, size_t size) {
+  if (size < 4) {
+    return min_max_scalar(data, size);
+  }
+  auto low = vld1q_f32(data), high = low;
+  size_t i = 4;
+  for (; i + 4 <= size; i += 4) {
+    auto x = vld1q_f32(data + i);
+    low = vminq_f32(low, x);
+    high = vmaxq_f32(high, x);
+  }
+  MinMax result{vminvq_f32(low), vmaxvq_f32(high)};
+  for (; i < size; i++) {
+    result.min = std::min(result.min, data[i]);
+    result.max = std::max(result.max, data[i]);
+  }
+  return result;
+}
+
+float abs_peak_neon(const float *data, size_t size) {
+  auto peak = vdupq_n_f32(0);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    peak = vmaxq_f32(peak, vabsq_f32(vld1q_f32(data + i)));
+  }
+  return std::max(vmaxvq_f32(peak), abs_peak_scalar(data + i, size - i));
+}
+
+void histogram_neon(const float *data, size_t size, float offset, float scale, size_t *bins, size_t bin_count) {
+  auto offsets = vdupq_n_f32(offset), scales = vdupq_n_f32(scale);
+  auto zero = vdupq_n_f32(0), top = vdupq_n_f32(static_cast<float>(bin_count - 1));
+  int32_t indices[4];
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto v = vmulq_f32(vaddq_f32(vld1q_f32(data + i), offsets), scales);
+    // maxnm returns the number when the other operand is NaN, as the scalar version does
+    v = vminq_f32(vmaxnmq_f32(v, zero), top);
+    vst1q_s32(indices, vcvtq_s32_f32(v));
+    for (auto index : indices) {
+      bins[index]++;
+    }
+  }
+  histogram_scalar(data + i, size - i, offset, scale, bins, bin_count);
+}
+
+void to_db_neon(const float *in, float *out, size_t size, float multiplier, float floor) {
+  auto factor = vdupq_n_f32(multiplier / Ln10), floors = vdupq_n_f32(floor);
+  auto smallest = vdupq_n_f32(FLT_MIN), largest = vdupq_n_f32(FLT_MAX);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto x = vminq_f32(vmaxnmq_f32(vld1q_f32(in + i), smallest), largest);
+    vst1q_f32(out + i, vmaxq_f32(vmulq_f32(log_neon(x), factor), floors));
+  }
+  to_db_scalar(in + i, out + i, size - i, multiplier, floor);
+}
+
+#endif
+
+constexpr MeterKernels scalar_kernels{"scalar", sum_of_squares_scalar, sum_of_squares_double_scalar, min_max_scalar,
+                                      abs_peak_scalar, histogram_scalar, to_db_scalar};
+#if JUCE_INTEL
+constexpr MeterKernels avx512_kernels{"avx512", sum_of_squares_avx512, sum_of_squares_double_avx512, min_max_avx512,
+                                      abs_peak_avx512, histogram_avx512, to_db_avx512};
+constexpr MeterKernels avx2_kernels{"avx2", sum_of_squares_avx2, sum_of_squares_double_avx2, min_max_avx2,
+                                    abs_peak_avx2, histogram_avx2, to_db_avx2};
+constexpr MeterKernels sse2_kernels{"sse2", sum_of_squares_sse2, sum_of_squares_double_sse2, min_max_sse2,
+                                    abs_peak_sse2, histogram_sse2, to_db_sse2};
+#elif defined(__aarch64__)
+constexpr MeterKernels neon_kernels{"neon", sum_of_squares_neon, sum_of_squares_double_neon, min_max_neon,
+                                    abs_peak_neon, histogram_neon, to_db_neon};
+#endif
+
+// The widest variant this CPU runs
+MeterKernels select_kernels() {
+#if JUCE_INTEL
+  if (SystemStats::hasAVX512F()) {
+    return avx512_kernels;
+  }
+  if (SystemStats::hasAVX2()) {
+    return avx2_kernels;
+  }
+  if (SystemStats::hasSSE2()) {
+    return sse2_kernels;
+  }
+#elif defined(__aarch64__)
+  return neon_kernels;
+#endif
+  return scalar_kernels;
+}
+
+}
+
+const MeterKernels &meter_kernels() {
+  // Picked on first use. Allocates and locks nothing after that, so that first use may be anywhere.
+  static const MeterKernels kernels = select_kernels();
+  return kernels;
+}
+
+const MeterKernels &scalar_meter_kernels() {
+  return scalar_kernels;
+}
+
+#if JUCE_UNIT_TESTS
+class MeterKernelsTest : public UnitTest {
+ public:
+  MeterKernelsTest() : UnitTest("MeterKernels", "loudmon") {}
+
+  void runTest() override {
+    std::vector<MeterKernels> supported;
+#if JUCE_INTEL
+    if (SystemStats::hasAVX512F()) {
+      supported.push_back(avx512_kernels);
+    }
+    if (SystemStats::hasAVX2()) {
+      supported.push_back(avx2_kernels);
+    }
+    if (SystemStats::hasSSE2()) {
+      supported.push_back(sse2_kernels);
+    }
+#elif defined(__aarch64__)
+    supported.push_back(neon_kernels);
+#endif
+    supported.push_back(scalar_kernels);
+
+    beginTest("Dispatch picks the widest variant");
+    expectEquals(String(meter_kernels().name), String(supported.front().name));
+    for (auto &kernels : supported) {
+      beginTest(String(kernels.name) + " against scalar");
+      expect_matches_reference(kernels);
+    }
+  }
+
+ private:
+  // Every length up to a few vectors of the widest variant, so that every tail length runs, and
+  //  misaligned starts. The levels cover the clamping of 0, negative and denormal inputs.
+  void expect_matches_reference(const MeterKernels &kernels) {
+    std::vector<float> data(1031 + 3);
+    std::vector<double> double_data(data.size());
+    uint32_t state = 12345;
+    for (size_t i = 0; i < data.size(); i++) {
+      state = state * 1664525u + 1013904223u;
+      data[i] = (static_cast<float>(state >> 8) / static_cast<float>(1 << 24) * 2 - 1) * 1.5f;
+      double_data[i] = data[i];
+    }
+    std::vector<float> levels(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+      levels[i] = data[i] * data[i] * static_cast<float>(i % 7 == 0 ? 1e-9 : 1e3);
+    }
+    levels[0] = 0;
+    levels[1] = -1;
+    levels[2] = FLT_MIN / 4;
+
+    auto &reference = scalar_kernels;
+    const size_t bin_count = 1000;
+    std::vector<size_t> expected_bins(bin_count), bins(bin_count);
+    std::vector<float> expected_db(data.size()), db(data.size());
+    std::vector<size_t> sizes;
+    for (size_t size = 1; size <= 80; size++) {
+      sizes.push_back(size);
+    }
+    sizes.push_back(1024);
+    sizes.push_back(1031);
+    for (size_t offset = 0; offset < 3; offset++) {
+      auto samples = data.data() + offset;
+      auto double_samples = double_data.data() + offset;
+      auto level_samples = levels.data() + offset;
+      for (auto size : sizes) {
+        auto expected = reference.sum_of_squares(samples, size);
+        expectWithinAbsoluteError(kernels.sum_of_squares(samples, size), expected, 1e-9 * expected);
+        expected = reference.sum_of_squares_double(double_samples, size);
+        expectWithinAbsoluteError(kernels.sum_of_squares_double(double_samples, size), expected, 1e-9 * expected);
+
+        auto min_max = kernels.min_max(samples, size), expected_min_max = reference.min_max(samples, size);
+        expectEquals(min_max.min, expected_min_max.min);
+        expectEquals(min_max.max, expected_min_max.max);
+        expectEquals(kernels.abs_peak(samples, size), reference.abs_peak(samples, size));
+
+        std::fill(expected_bins.begin(), expected_bins.end(), 0);
+        reference.histogram(samples, size, 1, bin_count / 2.0f, expected_bins.data(), bin_count);
+        std::fill(bins.begin(), bins.end(), 0);
+        kernels.histogram(samples, size, 1, bin_count / 2.0f, bins.data(), bin_count);
+        expect(bins == expected_bins, "histogram of " + String(static_cast<int>(size)) + " samples");
+
+        reference.to_db(level_samples, expected_db.data(), size, 20, -100);
+        kernels.to_db(level_samples, db.data(), size, 20, -100);
+        float db_error = 0;
+        for (size_t i = 0; i < size; i++) {
+          db_error = std::max(db_error, std::abs(db[i] - expected_db[i]));
+        }
+        expectLessThan(db_error, 1e-3f);
+      }
+    }
+  }
+};
+
+static MeterKernelsTest meter_kernels_test;
+#endif
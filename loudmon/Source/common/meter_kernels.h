@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+
+struct MinMax {
+  float min;
+  float max;
+};
+
+// The loops that metering spends its time in. Every kernel has a scalar reference version and SIMD
+//  versions for SSE2, AVX2 and AVX-512 on x86 and NEON on 64-bit ARM. The widest one the CPU runs
+//  is picked once, on first use, from CPUID. Results match the reference up to rounding, which
+//  MeterKernelsTest checks for every variant the CPU runs.
+struct MeterKernels {
+  const char *name;
+  // Sum of x^2, products and sum in double
+  double (*sum_of_squares)(const float *data, size_t size);
+  double (*sum_of_squares_double)(const double *data, size_t size);
+  // size > 0, finite data
+  MinMax (*min_max)(const float *data, size_t size);
+  // Largest |x|, 0 for size 0
+  float (*abs_peak)(const float *data, size_t size);
+  // bins[(x + offset) * scale]++ for every x, indices clamped to [0, bin_count). NaN goes to bin 0.
+  //  bin_count <= 2^24.
+  void (*histogram)(const float *data, size_t size, float offset, float scale, size_t *bins, size_t bin_count);
+  // out = max(multiplier * log10(in), floor), in place is fine. Inputs are clamped to the positive
+  //  normal floats first, so 0, denormals and NaN come out as floor for any sensible floor.
+  void (*to_db)(const float *in, float *out, size_t size, float multiplier, float floor);
+};
+
+// The kernels this CPU uses
+const MeterKernels &meter_kernels();
+// Plain C++, what the others are checked against
+const MeterKernels &scalar_meter_kernels();
+
+inline double sum_of_squares(const float *data, size_t size) {
+  return meter_kernels().sum_of_squares(data, size);
+}
+
+inline double sum_of_squares(const double *data, size_t size) {
+  return meter_kernels().sum_of_squares_double(data, size);
+}
@@ -0,0 +1,95 @@
+#include "metric_registry.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+
+MetricRegistry::MetricRegistry(size_t max_metrics, size_t max_values)
+    :max_metrics_(max_metrics),
+     max_values_(max_values),
+     metrics_(max_metrics),
+     values_(std::make_unique<std::atomic<float>[]>(max_values)),
+     dirty_(std::make_unique<std::atomic<uint64_t>[]>((max_metrics + 63) / 64)) {
+  for (size_t i = 0; i < max_values_; i++) {
+    values_[i].store(0, std::memory_order_relaxed);
+  }
+  for (size_t i = 0; i < (max_metrics_ + 63) / 64; i++) {
+    dirty_[i].store(0, std::memory_order_relaxed);
+  }
+  // Reserve once, so that formatting never reallocates
+  text_.reserve(4096);
+}
+
+void MetricRegistry::register_metric(size_t id, MetricSpec spec) {
+  assert(id < max_metrics_ && !metrics_[id].registered);
+  assert(used_values_ + spec.value_count <= max_values_);
+
+  auto &metric = metrics_[id];
+  metric.registered = true;
+  metric.value_offset = used_values_;
+  metric.value_count = spec.value_count;
+  metric.shown_count = spec.value_count;
+  metric.scale = std::pow(10.0f, static_cast<float>(spec.precision));
+  // name, separators and up to 24 characters per value
+  metric.line.resize(spec.name.size() + 3 + spec.value_count * (spec.unit.size() + spec.separator.size() + 24));
+  metric.spec = std::move(spec);
+  used_values_ += metric.value_count;
+  dirty_[id / 64].fetch_or(uint64_t(1) << (id % 64u));
+}
+
+void MetricRegistry::set_value_count(size_t id, size_t count) {
+  auto &metric = metrics_[id];
+  metric.shown_count = std::min(count, metric.value_count);
+  dirty_[id / 64].fetch_or(uint64_t(1) << (id % 64u), std::memory_order_release);
+}
+
+bool MetricRegistry::format_changed() {
+  bool changed = false;
+  for (size_t word = 0; word < (max_metrics_ + 63) / 64; word++) {
+    auto bits = dirty_[word].exchange(0, std::memory_order_acquire);
+    while (bits) {
+      size_t bit = 0;
+      while (!(bits & (uint64_t(1) << bit))) {
+        bit++;
+      }
+      bits &= ~(uint64_t(1) << bit);
+
+      auto &metric = metrics_[word * 64 + bit];
+      if (!metric.registered) {
+        continue;
+      }
+      auto buf = metric.line.data();
+      auto remaining = metric.line.size();
+      auto append = [&](int n) {
+        if (n > 0) {
+          auto written = std::min(static_cast<size_t>(n), remaining - 1);
+          buf += written;
+          remaining -= written;
+        }
+      };
+      append(std::snprintf(buf, remaining, "%s: ", metric.spec.name.c_str()));
+      auto shown_count = metric.shown_count.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < shown_count; i++) {
+        append(std::snprintf(buf, remaining, "%s%.*f%s",
+                             i == 0 ? "" : metric.spec.separator.c_str(),
+                             metric.spec.precision,
+                             values_[metric.value_offset + i].load(std::memory_order_relaxed),
+                             metric.spec.unit.c_str()));
+      }
+      metric.line_size = metric.line.size() - remaining;
+      changed = true;
+    }
+  }
+
+  if (changed) {
+    text_.clear();
+    for (auto &metric : metrics_) {
+      if (metric.registered) {
+        text_.append(metric.line.data(), metric.line_size);
+        text_.push_back('\n');
+      }
+    }
+  }
+  return changed;
+}
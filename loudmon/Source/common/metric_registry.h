@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct MetricSpec {
+  std::string name;
+  std::string unit;
+  int precision = 2;
+  // e.g. one value per channel
+  size_t value_count = 1;
+  std::string separator = " ";
+};
+
+// Metrics are registered once with an integer id. Updates from any thread (including the audio thread)
+//  only store a raw float and set a dirty bit, formatting happens in the UI thread and only for metrics
+//  that changed since the last format.
+class MetricRegistry {
+ public:
+  explicit MetricRegistry(size_t max_metrics = 64, size_t max_values = 256);
+
+  // Not thread safe, register everything before the first set()
+  void register_metric(size_t id, MetricSpec spec);
+  // Shows only the first count values of the metric, at most the registered value_count, e.g. the
+  //  channels of the current layout. Any thread.
+  void set_value_count(size_t id, size_t count);
+
+  /* May be in any thread, lock-free */
+  void set(size_t id, float value) {
+    set(id, 0, value);
+  }
+  // Only marks the metric dirty when the value changed at its display precision
+  void set(size_t id, size_t index, float value) {
+    auto &metric = metrics_[id];
+    if (index < metric.value_count) {
+      auto previous = values_[metric.value_offset + index].exchange(value, std::memory_order_relaxed);
+      if (std::nearbyint(previous * metric.scale) != std::nearbyint(value * metric.scale)) {
+        dirty_[id / 64].fetch_or(uint64_t(1) << (id % 64u), std::memory_order_release);
+      }
+    }
+  }
+  float get(size_t id, size_t index = 0) const {
+    auto &metric = metrics_[id];
+    return values_[metric.value_offset + index].load(std::memory_order_relaxed);
+  }
+
+  /* UI thread */
+  // Formats the metrics that changed, returns whether the text changed
+  bool format_changed();
+  const std::string &text() const {
+    return text_;
+  }
+
+ private:
+  struct Metric {
+    bool registered = false;
+    MetricSpec spec;
+    size_t value_offset = 0;
+    size_t value_count = 0;
+    std::atomic<size_t> shown_count = 0;
+    // 10^precision
+    float scale = 1;
+    std::vector<char> line;
+    size_t line_size = 0;
+  };
+
+  size_t max_metrics_;
+  size_t max_values_;
+  std::vector<Metric> metrics_;
+  std::unique_ptr<std::atomic<float>[]> values_;
+  size_t used_values_ = 0;
+  std::unique_ptr<std::atomic<uint64_t>[]> dirty_;
+  std::string text_;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+
+// Counting semaphore, waiting threads sleep instead of spinning.
+// Replace with std::counting_semaphore once we move to C++20.
+class Semaphore {
+ public:
+  explicit Semaphore(size_t count = 0) :count_(count) { }
+
+  void release(size_t n = 1) {
+    {
+      std::unique_lock<std::mutex> _(lock_);
+      count_ += n;
+    }
+    if (n == 1) {
+      cv_.notify_one();
+    } else {
+      cv_.notify_all();
+    }
+  }
+
+  void acquire() {
+    std::unique_lock<std::mutex> lock(lock_);
+    cv_.wait(lock, [this]() { return count_ > 0; });
+    count_--;
+  }
+
+  bool try_acquire() {
+    std::unique_lock<std::mutex> _(lock_);
+    if (count_ == 0) {
+      return false;
+    }
+    count_--;
+    return true;
+  }
+
+ private:
+  size_t count_;
+  std::mutex lock_;
+  std::condition_variable cv_;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/* Hands values from one writer thread to one reader thread without either ever waiting. The writer
+ *  fills the back slot, then swaps it with the middle slot and marks it fresh. The reader swaps its
+ *  front slot with the middle one only when it is fresh. Neither side ever touches the slot the other
+ *  one owns, so values may be large and are reused instead of being reclaimed. */
+template <typename T>
+class TripleBuffer {
+ public:
+  static constexpr size_t SlotCount = 3;
+
+  /* Writer */
+  T &back() {
+    return slots_[back_];
+  }
+  void publish() {
+    back_ = middle_.exchange(static_cast<uint8_t>(back_ | Fresh), std::memory_order_acq_rel) & SlotMask;
+  }
+
+  /* Reader */
+  // Moves to the latest published value, true if there was one since the last call
+  bool acquire() {
+    if (!(middle_.load(std::memory_order_relaxed) & Fresh)) {
+      return false;
+    }
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & SlotMask;
+    return true;
+  }
+  T &front() {
+    return slots_[front_];
+  }
+
+  // Every slot, e.g. to allocate them. Neither side may run meanwhile.
+  T &slot(size_t index) {
+    return slots_[index];
+  }
+
+ private:
+  static constexpr uint8_t SlotMask = 0x3;
+  static constexpr uint8_t Fresh = 0x4;
+  std::array<T, SlotCount> slots_;
+  std::atomic<uint8_t> middle_ = 1;
+  uint8_t back_ = 0;
+  uint8_t front_ = 2;
+};
@@ -1,72 +1,229 @@
 #include "ui_updater.h"
 #include <numeric>
+#if JUCE_LINUX
+ #include <sys/resource.h>
+#elif JUCE_MAC
+ #include <pthread/qos.h>
+#endif
 
-UIUpdater::UIUpdater(float fps) {
-  startTimer(static_cast<int>(1000.0f / fps));
+#include "../loudmon/utils.h"
+
+UIUpdater::UIUpdater(float fps, size_t thread_count) {
+  if (thread_count == 0) {
+    // Leave most cores to the audio threads, there may be many plugin instances
+    thread_count = clip<size_t>(std::thread::hardware_concurrency() / 4, 1, 4);
+  }
+  thread_count_ = thread_count;
+  for (size_t i = 0; i < message_pool_size_; i++) {
+    release_message(&message_pool_[i]);
+  }
   for (size_t i = 0; i < thread_count_; i++) {
-    thread_pool_.emplace_back(std::bind(&UIUpdater::ui_processing_worker_callback, this));
+    workers_.push_back(std::make_unique<UIProcessingWorker>());
   }
+  for (size_t i = 0; i < thread_count_; i++) {
+    thread_pool_.emplace_back(std::bind(&UIUpdater::ui_processing_worker_callback, this, i));
+  }
+  startTimer(static_cast<int>(1000.0f / fps));
 }
 
 UIUpdater::~UIUpdater() {
-  worker_quit_ = true;
+  stop_ui_updater();
+}
+
+void UIUpdater::stop_ui_updater() {
+  stopTimer();
+  if (worker_quit_.exchange(true)) {
+    return;
+  }
+  ui_processing_jobs_.release(thread_pool_.size());
   for (auto &t : thread_pool_) {
     t.join();
   }
 }
 
 void UIUpdater::enqueue_ui(std::function<void()> action) {
-  std::unique_lock<std::mutex> _(queue_lock);
-  if (queued_actions.size() >= queue_max_size_) {
-    queued_actions.pop_front();
+  // The ring cannot evict its oldest entry without a consumer, so the newest message is dropped instead.
+  //  Messages that must not get lost should use a coalescing key.
+  if (!queued_actions_.try_push(UIMessage{std::move(action), std::chrono::high_resolution_clock::now()})) {
     ui_queue_loss_++;
   }
-  queued_actions.emplace_back(std::move(action), std::chrono::high_resolution_clock::now());
 }
 
-void UIUpdater::timerCallback() {
-  for (size_t i = 0; i < max_actions_per_interval_; i++) {
-    std::function<void()> action;
-    {
-      std::unique_lock<std::mutex> _(queue_lock);
-      if (queued_actions.empty()) {
-        break;
+void UIUpdater::enqueue_ui(uint64_t coalescing_key, std::function<void()> action) {
+  jassert(coalescing_key != 0);
+  auto slot = find_coalescing_slot(coalescing_key);
+  if (!slot) {
+    enqueue_ui(std::move(action));
+    return;
+  }
+
+  auto message = acquire_message();
+  if (!message) {
+    ui_queue_loss_++;
+    return;
+  }
+  message->action = std::move(action);
+  message->enqueue_time = std::chrono::high_resolution_clock::now();
+  auto previous = slot->latest.exchange(message, std::memory_order_acq_rel);
+  if (previous) {
+    // The slot is already queued, the UI thread will pick up the new message
+    release_message(previous);
+    ui_queue_coalesced_++;
+  } else {
+    // The queue holds every slot at most once so it can never be full here
+    auto pushed = pending_coalesced_.try_push(static_cast<size_t>(slot - coalescing_slots_.get()));
+    jassert(pushed);
+    (void)pushed;
+  }
+}
+
+UIUpdater::UIMessage *UIUpdater::acquire_message() {
+  auto head = free_messages_.load(std::memory_order_acquire);
+  while (true) {
+    auto index = static_cast<uint32_t>(head);
+    if (index == 0) {
+      return nullptr;
+    }
+    auto message = &message_pool_[index - 1];
+    auto next = message->next_free.load(std::memory_order_relaxed);
+    auto popped = ((head >> 32u) + 1) << 32u | next;
+    if (free_messages_.compare_exchange_weak(head, popped, std::memory_order_acq_rel)) {
+      return message;
+    }
+  }
+}
+
+void UIUpdater::release_message(UIMessage *message) {
+  message->action = nullptr;
+  auto index = static_cast<uint64_t>(message - message_pool_.get()) + 1;
+  auto head = free_messages_.load(std::memory_order_relaxed);
+  do {
+    message->next_free.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+  } while (!free_messages_.compare_exchange_weak(head, (head & ~uint64_t(0xffffffffu)) | index, std::memory_order_release));
+}
+
+UIUpdater::CoalescingSlot *UIUpdater::find_coalescing_slot(uint64_t key) {
+  // Open addressing, slots are claimed once and never released
+  for (size_t i = 0; i < max_coalescing_keys_; i++) {
+    auto &slot = coalescing_slots_[(key + i) % max_coalescing_keys_];
+    auto slot_key = slot.key.load(std::memory_order_acquire);
+    if (slot_key == 0) {
+      uint64_t expected = 0;
+      if (slot.key.compare_exchange_strong(expected, key, std::memory_order_acq_rel) || expected == key) {
+        return &slot;
       }
-      auto latency = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - std::get<1>(queued_actions.front()));
-      ui_latencies_[ui_latency_index_++] = latency.count();
-      ui_latency_index_ %= ui_latencies_.size();
-      average_ui_latency_ = std::accumulate(ui_latencies_.begin(), ui_latencies_.end(), 0.0f) / ui_latencies_.size();
-      action = std::move(std::get<0>(queued_actions.front()));
-      queued_actions.pop_front();
-      last_ui_queue_size_ = queued_actions.size();
+    } else if (slot_key == key) {
+      return &slot;
     }
-    action();
   }
+  return nullptr;
+}
+
+void UIUpdater::run_ui_message(UIMessage &message) {
+  auto latency = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - message.enqueue_time);
+  ui_latencies_[ui_latency_index_++] = latency.count();
+  ui_latency_index_ %= ui_latencies_.size();
+  average_ui_latency_ = std::accumulate(ui_latencies_.begin(), ui_latencies_.end(), 0.0f) / ui_latencies_.size();
+  message.action();
+}
+
+void UIUpdater::timerCallback() {
+  size_t i = 0;
+  // Coalesced messages first, they carry the latest state
+  size_t slot_index;
+  while (i < max_actions_per_interval_ && pending_coalesced_.try_pop(slot_index)) {
+    auto message = coalescing_slots_[slot_index].latest.exchange(nullptr, std::memory_order_acq_rel);
+    if (message) {
+      run_ui_message(*message);
+      release_message(message);
+      i++;
+    }
+  }
+
+  UIMessage message;
+  while (i < max_actions_per_interval_ && queued_actions_.try_pop(message)) {
+    run_ui_message(message);
+    i++;
+  }
+  last_ui_queue_size_ = queued_actions_.size_approx() + pending_coalesced_.size_approx();
+
+  ui_frame();
 }
 
 void UIUpdater::enqueue_ui_processing(std::function<void()> action) {
-  std::unique_lock<std::mutex> _(ui_processing_queue_lock);
-  if (ui_processing_queue.size() >= ui_processing_queue_max_size_) {
-    ui_processing_queue.pop_front();
+  auto &worker = *workers_[next_worker_++ % workers_.size()];
+  {
+    std::unique_lock<std::mutex> _(worker.jobs_lock);
+    if (worker.jobs.size() >= ui_processing_queue_max_size_ / workers_.size()) {
+      // The permit of the dropped job stays, a worker will wake up once for nothing
+      worker.jobs.pop_front();
+    }
+    worker.jobs.push_back(UIMessage{std::move(action), std::chrono::high_resolution_clock::now()});
   }
-  ui_processing_queue.emplace_back(std::move(action), std::chrono::high_resolution_clock::now());
+  ui_processing_jobs_.release();
 }
-void UIUpdater::ui_processing_worker_callback() {
-  while (!worker_quit_) {
-    std::this_thread::yield();
-
-    std::function<void()> action;
-    {
-      std::unique_lock<std::mutex> _(ui_processing_queue_lock);
-      if (ui_processing_queue.empty()) {
-        continue;
-      }
-      ui_processing_latencies_[ui_processing_latency_index_++] = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - std::get<1>(ui_processing_queue.front())).count();
-      ui_processing_latency_index_ %= ui_processing_latencies_.size();
-      average_ui_processing_latency_ = std::accumulate(ui_processing_latencies_.begin(), ui_processing_latencies_.end(), 0.0f) / ui_processing_latencies_.size();
-      action = std::move(std::get<0>(ui_processing_queue.front()));
-      ui_processing_queue.pop_front();
+
+bool UIUpdater::pop_ui_processing_job(size_t worker_index, UIMessage &job) {
+  {
+    auto &own = *workers_[worker_index];
+    std::unique_lock<std::mutex> _(own.jobs_lock);
+    if (!own.jobs.empty()) {
+      job = std::move(own.jobs.front());
+      own.jobs.pop_front();
+      return true;
     }
-    action();
   }
+  // Steal the newest job from the other end of someone else's deque
+  for (size_t i = 1; i < workers_.size(); i++) {
+    auto &victim = *workers_[(worker_index + i) % workers_.size()];
+    std::unique_lock<std::mutex> _(victim.jobs_lock);
+    if (!victim.jobs.empty()) {
+      job = std::move(victim.jobs.back());
+      victim.jobs.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void UIUpdater::ui_processing_worker_callback(size_t worker_index) {
+  // UI processing must never compete with the audio thread, nor with the message thread. JUCE maps
+  //  any priority above 0 to realtime scheduling on posix, there the thread stays a normal one and
+  //  is lowered by the OS's own means.
+#if JUCE_WINDOWS
+  juce::Thread::setCurrentThreadPriority(2);
+#else
+  juce::Thread::setCurrentThreadPriority(0);
+ #if JUCE_LINUX
+  // Linux keeps the nice value per thread, 0 is the calling one
+  setpriority(PRIO_PROCESS, 0, 10);
+ #elif JUCE_MAC
+  pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+ #endif
+#endif
+
+  auto &worker = *workers_[worker_index];
+  while (true) {
+    ui_processing_jobs_.acquire();
+    if (worker_quit_) {
+      break;
+    }
+
+    UIMessage job;
+    if (!pop_ui_processing_job(worker_index, job)) {
+      continue;
+    }
+    worker.latencies[worker.latency_index++] = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - job.enqueue_time).count();
+    worker.latency_index %= worker.latencies.size();
+    worker.average_latency = std::accumulate(worker.latencies.begin(), worker.latencies.end(), 0.0f) / worker.latencies.size();
+    job.action();
+  }
+}
+
+float UIUpdater::get_average_ui_processing_latency() const {
+  float sum = 0;
+  for (auto &worker : workers_) {
+    sum += worker->average_latency;
+  }
+  return workers_.empty() ? 0 : sum / workers_.size();
 }
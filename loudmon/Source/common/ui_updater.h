@@ -1,15 +1,30 @@
 #pragma once
 
+#include <deque>
+#include <thread>
+
 #include <JuceHeader.h>
+#include "mpmc_queue.h"
+#include "semaphore.h"
 
 
 class UIUpdater :public juce::Timer {
  public:
-  explicit UIUpdater(float fps = 30);
+  // thread_count == 0 picks a worker count from the number of cores
+  explicit UIUpdater(float fps = 30, size_t thread_count = 0);
   ~UIUpdater() override;
+  // Stops the timer and joins the workers. Derived classes call this first in their destructor,
+  //  so that no queued job runs against members that are already destroyed.
+  void stop_ui_updater();
   void timerCallback() override;
+  // Called on the UI thread once per timer tick after the queued messages ran.
+  //  State changes should only mark things dirty, formatting and repainting happens here.
+  virtual void ui_frame() { }
 
   void enqueue_ui(std::function<void()> action);
+  // Messages with the same non-zero coalescing key overwrite each other in place until the UI thread runs them,
+  //  so only the latest one is executed. The queue depth is bounded by the number of distinct keys.
+  void enqueue_ui(uint64_t coalescing_key, std::function<void()> action);
   void enqueue_ui_processing(std::function<void()> action);
 
   float get_average_ui_latency() const {
@@ -21,34 +36,81 @@ class UIUpdater :public juce::Timer {
   size_t get_ui_queue_loss() const {
     return ui_queue_loss_;
   }
-
-  float get_average_ui_processing_latency() const {
-    return average_ui_processing_latency_;
+  size_t get_ui_queue_coalesced() const {
+    return ui_queue_coalesced_;
   }
 
+  float get_average_ui_processing_latency() const;
+
  private:
-  void ui_processing_worker_callback();
+  struct UIMessage {
+    std::function<void()> action;
+    std::chrono::high_resolution_clock::time_point enqueue_time;
+    // Pool messages only, the next free one, 1-based so that 0 ends the list
+    std::atomic<uint32_t> next_free = 0;
+
+    UIMessage() = default;
+    UIMessage(std::function<void()> action, std::chrono::high_resolution_clock::time_point enqueue_time)
+        :action(std::move(action)), enqueue_time(enqueue_time) { }
+    UIMessage(UIMessage &&other) noexcept :action(std::move(other.action)), enqueue_time(other.enqueue_time) { }
+    UIMessage &operator=(UIMessage &&other) noexcept {
+      action = std::move(other.action);
+      enqueue_time = other.enqueue_time;
+      return *this;
+    }
+  };
+  struct CoalescingSlot {
+    std::atomic<uint64_t> key = 0;
+    std::atomic<UIMessage*> latest = nullptr;
+  };
+
+  struct UIProcessingWorker {
+    std::deque<UIMessage> jobs;
+    std::mutex jobs_lock;
+    std::vector<float> latencies = std::vector<float>(16);
+    size_t latency_index = 0;
+    std::atomic<float> average_latency = 0;
+  };
+
+  CoalescingSlot *find_coalescing_slot(uint64_t key);
+  // From the pool, nullptr when it is empty. Lock-free.
+  UIMessage *acquire_message();
+  // Destroys the action and puts the message back into the pool
+  void release_message(UIMessage *message);
+  void run_ui_message(UIMessage &message);
+  bool pop_ui_processing_job(size_t worker_index, UIMessage &job);
+  void ui_processing_worker_callback(size_t worker_index);
  private:
   size_t max_actions_per_interval_ = 256;
   size_t queue_max_size_ = 256;
+  size_t max_coalescing_keys_ = 128;
   size_t ui_processing_queue_max_size_ = 4096;
   size_t thread_count_ = 1;
 
   // UI jobs
-  std::list<std::tuple<std::function<void()>, std::chrono::high_resolution_clock::time_point>> queued_actions;
+  BoundedMPMCQueue<UIMessage> queued_actions_ = BoundedMPMCQueue<UIMessage>(queue_max_size_);
+  std::unique_ptr<CoalescingSlot[]> coalescing_slots_ = std::make_unique<CoalescingSlot[]>(max_coalescing_keys_);
+  // Coalesced messages come from here, so that producers on the audio thread never allocate. Every
+  //  slot holds at most one message, the rest covers the ones being replaced or run at that moment.
+  size_t message_pool_size_ = max_coalescing_keys_ * 2;
+  std::unique_ptr<UIMessage[]> message_pool_ = std::make_unique<UIMessage[]>(message_pool_size_);
+  // Treiber stack of free pool messages: 1-based index of the top in the low 32 bits, a counter
+  //  that changes on every pop in the high ones, so that a stale compare-exchange fails (ABA)
+  std::atomic<uint64_t> free_messages_ = 0;
+  // Indices of coalescing slots that hold a message, each slot is in here at most once
+  BoundedMPMCQueue<size_t> pending_coalesced_ = BoundedMPMCQueue<size_t>(max_coalescing_keys_);
   std::atomic<float> average_ui_latency_ = 0;
   std::atomic<size_t> ui_queue_loss_ = 0;
+  std::atomic<size_t> ui_queue_coalesced_ = 0;
   std::atomic<size_t> last_ui_queue_size_ = 0;
   std::vector<float> ui_latencies_ = std::vector<float>(16);
   size_t ui_latency_index_ = 0;
-  std::mutex queue_lock;
 
-  // UI processing workers
+  // UI processing workers, each one owns a deque and steals from the others when its own one is empty
   std::atomic<bool> worker_quit_ = false;
-  std::atomic<float> average_ui_processing_latency_ = 0;
-  std::vector<float> ui_processing_latencies_ = std::vector<float>(16);
-  size_t ui_processing_latency_index_ = 0;
+  std::vector<std::unique_ptr<UIProcessingWorker>> workers_;
+  std::atomic<size_t> next_worker_ = 0;
+  // One permit per queued job, idle workers sleep here
+  Semaphore ui_processing_jobs_;
   std::vector<std::thread> thread_pool_;
-  std::list<std::tuple<std::function<void()>, std::chrono::high_resolution_clock::time_point>> ui_processing_queue;
-  std::mutex ui_processing_queue_lock;
-};
\ No newline at end of file
+};
@@ -0,0 +1,105 @@
+#include "worker_group.h"
+
+#include <functional>
+#include <JuceHeader.h>
+
+WorkerGroup::WorkerGroup(size_t worker_count, int thread_priority)
+    :parking_(std::make_unique<Parking[]>(worker_count)) {
+  for (size_t i = 0; i < worker_count; i++) {
+    workers_.emplace_back(std::bind(&WorkerGroup::worker_thread, this, i + 1, thread_priority));
+  }
+}
+
+WorkerGroup::~WorkerGroup() {
+  quit_ = true;
+  wake_parked();
+  for (auto &t : workers_) {
+    t.join();
+  }
+}
+
+void WorkerGroup::run(size_t count, void (*task)(void*, size_t, size_t), void *context, Clock::time_point claim_deadline) {
+  jassert(count <= MaxTasks);
+  if (count == 0) {
+    return;
+  }
+  task_ = task;
+  context_ = context;
+  done_.store(0, std::memory_order_relaxed);
+  auto generation = (claim_.load(std::memory_order_relaxed) >> 32u) + 1;
+  claim_.store((generation << 32u) | (static_cast<uint64_t>(count) << 16u));
+  wake_parked();
+
+  work(0, claim_deadline);
+  // Only tasks that workers started before the deadline and are still running are left
+  while (done_.load(std::memory_order_acquire) < count) {
+    std::this_thread::yield();
+  }
+}
+
+void WorkerGroup::work(size_t participant, Clock::time_point claim_deadline) {
+  auto claim = claim_.load(std::memory_order_acquire);
+  while (true) {
+    auto index = claim & IndexMask;
+    auto count = (claim >> 16u) & IndexMask;
+    if (index >= count) {
+      return;
+    }
+    if (claim_deadline != Clock::time_point::max() && Clock::now() >= claim_deadline) {
+      // Claims everything that is left in one go
+      if (claim_.compare_exchange_weak(claim, claim - index + count, std::memory_order_acq_rel)) {
+        for (auto i = index; i < count; i++) {
+          task_(context_, static_cast<size_t>(i), participant);
+        }
+        done_.fetch_add(static_cast<size_t>(count - index), std::memory_order_release);
+        return;
+      }
+      continue;
+    }
+    if (claim_.compare_exchange_weak(claim, claim + 1, std::memory_order_acq_rel)) {
+      task_(context_, static_cast<size_t>(index), participant);
+      done_.fetch_add(1, std::memory_order_release);
+      claim = claim_.load(std::memory_order_acquire);
+    }
+  }
+}
+
+void WorkerGroup::wake_parked() {
+  for (size_t i = 0; i < workers_.size(); i++) {
+    auto &parking = parking_[i];
+    if (parking.parked.load() && parking.parked.exchange(false)) {
+      parking.wake.release();
+    }
+  }
+}
+
+void WorkerGroup::worker_thread(size_t participant, int thread_priority) {
+  juce::Thread::setCurrentThreadPriority(thread_priority);
+  auto &parking = parking_[participant - 1];
+  uint64_t seen_generation = 0;
+  int idle_spins = 0;
+  while (!quit_) {
+    auto generation = claim_.load(std::memory_order_acquire) >> 32u;
+    if (generation != seen_generation) {
+      seen_generation = generation;
+      work(participant, Clock::time_point::max());
+      idle_spins = 0;
+      continue;
+    }
+    // Blocks follow each other closely, spinning a little saves the wake up latency
+    if (idle_spins < spin_count_) {
+      idle_spins++;
+      std::this_thread::yield();
+      continue;
+    }
+    parking.parked = true;
+    if ((claim_.load() >> 32u) != seen_generation || quit_) {
+      // A run or quit came in meanwhile. If the caller cleared parked already, its wake is on the way.
+      if (parking.parked.exchange(false)) {
+        continue;
+      }
+    }
+    parking.wake.acquire();
+    idle_spins = 0;
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "semaphore.h"
+
+// Runs small sets of tasks on preallocated threads, for the audio thread. The calling thread takes
+//  part, and tasks are claimed one at a time, so whatever the workers did not pick up in time runs on
+//  the caller: a late or descheduled worker degrades to serial rendering instead of missing the
+//  deadline. Workers spin briefly after a run and then park on a semaphore. Publishing a run is an
+//  atomic store, the caller only posts a wake, which takes the semaphore's lock, for workers that
+//  actually parked, i.e. after a pause in playback.
+class WorkerGroup {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // worker_count threads besides the caller
+  explicit WorkerGroup(size_t worker_count, int thread_priority = 9);
+  ~WorkerGroup();
+
+  // Threads that can run tasks, including the caller
+  size_t participant_count() const {
+    return workers_.size() + 1;
+  }
+
+  // Calls task(index, participant) for every index in [0, count) and returns once all are done.
+  //  participant 0 is the caller. Does not allocate. Only one thread may call run at a time.
+  //  From claim_deadline on, the caller takes all tasks that are left at once, so workers can no
+  //  longer start any, and only waits for the ones they started before.
+  template <typename F>
+  void run(size_t count, F &task, Clock::time_point claim_deadline = Clock::time_point::max()) {
+    run(count, &invoke<F>, &task, claim_deadline);
+  }
+  void run(size_t count, void (*task)(void*, size_t, size_t), void *context,
+           Clock::time_point claim_deadline = Clock::time_point::max());
+
+ private:
+  template <typename F>
+  static void invoke(void *context, size_t index, size_t participant) {
+    (*static_cast<F*>(context))(index, participant);
+  }
+  void worker_thread(size_t participant, int thread_priority);
+  // Claims and runs tasks of the current run until none are left
+  void work(size_t participant, Clock::time_point claim_deadline);
+  // Posts a wake to every worker that parked, after a run or quit_ was published
+  void wake_parked();
+
+  /* The claim word packs generation (bits 32-63), task count (16-31) and next index (0-15), so a
+   * task can only be claimed together with the run it belongs to. A claimed task keeps the run
+   * from finishing, so task_ and context_ stay valid while it executes. */
+  static constexpr uint64_t IndexMask = 0xffff;
+  static constexpr size_t MaxTasks = 0xffff;
+  std::atomic<uint64_t> claim_ = 0;
+  std::atomic<size_t> done_ = 0;
+  void (*task_)(void*, size_t, size_t) = nullptr;
+  void *context_ = nullptr;
+
+  std::atomic<bool> quit_ = false;
+  const int spin_count_ = 4000;
+  // One per worker. A worker sets parked before it checks for a run a last time and sleeps, the
+  //  caller sets claim_ before it checks parked, so one of them always sees the other. Whoever
+  //  clears parked owns the wake.
+  struct Parking {
+    std::atomic<bool> parked = false;
+    Semaphore wake;
+  };
+  std::unique_ptr<Parking[]> parking_;
+  std::vector<std::thread> workers_;
+};
@@ -0,0 +1,22 @@
+#include "analysis_governor.h"
+
+void AnalysisGovernor::add_block(double cost_seconds, double block_seconds) {
+  if (block_seconds <= 0) {
+    return;
+  }
+  auto load = static_cast<float>(cost_seconds / block_seconds);
+  load_ += (load - load_) * Smoothing;
+  since_step_ += block_seconds;
+  below_recover_ = load_ < RecoverLoad ? below_recover_ + block_seconds : 0;
+
+  auto tier = tier_.load(std::memory_order_relaxed);
+  // At most one step per hold, a burst of late blocks costs a single tier
+  auto overloaded = since_step_ >= HoldSeconds && (load > 1 || load_ > DegradeLoad);
+  if (overloaded && tier + 1 < AnalysisTierCount) {
+    tier_.store(tier + 1, std::memory_order_relaxed);
+    since_step_ = below_recover_ = 0;
+  } else if (below_recover_ >= RecoverSeconds && tier > 0) {
+    tier_.store(tier - 1, std::memory_order_relaxed);
+    since_step_ = below_recover_ = 0;
+  }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// How much the meters and plots may cost. Intervals count host blocks: 1 is every block.
+struct AnalysisTier {
+  // The spectrum transform has 2^fft_order points
+  int fft_order;
+  size_t spectrum_interval;
+  size_t entropy_interval;
+  // Band RMS meters, on the audio thread
+  size_t band_interval;
+  // Samples per oscilloscope column, drawn as their min and max
+  size_t oscilloscope_decimation;
+};
+
+// From full quality down to what still tells something
+constexpr AnalysisTier AnalysisTiers[] = {
+    {12, 1, 1, 1, 1},
+    {11, 2, 4, 2, 2},
+    {10, 4, 8, 4, 4},
+    {9, 8, 16, 8, 8},
+};
+constexpr size_t AnalysisTierCount = sizeof(AnalysisTiers) / sizeof(AnalysisTiers[0]);
+
+/* Trades analysis quality for CPU headroom. Fed with the cost of every block against its duration,
+ *  it steps to a cheaper tier when a block is late or the smoothed load stays high, and back to a
+ *  richer one only after the load stayed low for a while. Downward steps are at least a hold apart,
+ *  so that each new tier shows in the load before the next one. The gap between the two thresholds
+ *  and the hold keep it from oscillating. Audio output never depends on the tier,
+ *  the meters and plots give way before the audio does. */
+class AnalysisGovernor {
+ public:
+  /* Audio thread */
+  void add_block(double cost_seconds, double block_seconds);
+  // Smoothed cost over duration, 1 is a block that was just in time
+  float load() const {
+    return load_;
+  }
+
+  /* Any thread */
+  // 0 is full quality
+  size_t tier() const {
+    return tier_.load(std::memory_order_relaxed);
+  }
+  const AnalysisTier &settings() const {
+    return AnalysisTiers[tier()];
+  }
+
+ private:
+  static constexpr float DegradeLoad = 0.6f;
+  static constexpr float RecoverLoad = 0.3f;
+  // After a step, so that the new tier shows in the load before the next one
+  static constexpr double HoldSeconds = 0.5;
+  static constexpr double RecoverSeconds = 5;
+  // Per block
+  static constexpr float Smoothing = 0.1f;
+
+  float load_ = 0;
+  // The first late block may step right away
+  double since_step_ = HoldSeconds;
+  double below_recover_ = 0;
+  std::atomic<size_t> tier_ = 0;
+};
@@ -0,0 +1,294 @@
+#include "async_logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+static int64_t steady_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LogRing::LogRing(size_t capacity) {
+  size_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  records_.resize(size);
+  mask_ = size - 1;
+}
+
+bool LogRing::try_pop(LogRecord &record) {
+  auto tail = tail_.load(std::memory_order_relaxed);
+  auto head = head_.load(std::memory_order_acquire);
+  if (tail == head) {
+    return false;
+  }
+  record = records_[tail & mask_];
+  tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+std::atomic<int> AsyncLogger::level_ = LogLevelDefault;
+
+AsyncLogger &AsyncLogger::instance() {
+  static AsyncLogger logger;
+  return logger;
+}
+
+AsyncLogger::AsyncLogger() {
+  formats_.emplace_back("%s");
+  auto system_now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  system_clock_offset_ns_ = system_now - steady_now_ns();
+  batch_.reserve(ring_capacity_);
+  consumer_ = std::thread(std::bind(&AsyncLogger::consumer_thread, this));
+}
+
+AsyncLogger::~AsyncLogger() {
+  {
+    std::unique_lock<std::mutex> _(quit_lock_);
+    quit_ = true;
+  }
+  quit_cv_.notify_all();
+  consumer_.join();
+}
+
+uint16_t AsyncLogger::register_format(const std::string &format) {
+  std::unique_lock<std::mutex> _(formats_lock_);
+  for (size_t i = 0; i < formats_.size(); i++) {
+    if (formats_[i] == format) {
+      return static_cast<uint16_t>(i);
+    }
+  }
+  formats_.push_back(format);
+  return static_cast<uint16_t>(formats_.size() - 1);
+}
+
+LogRing &AsyncLogger::thread_ring() {
+  // The first log call of every thread allocates its ring, afterwards writing never allocates or locks.
+  //  The registry keeps the ring alive until it is drained after the thread exited.
+  thread_local std::shared_ptr<LogRing> ring;
+  thread_local const AsyncLogger *ring_owner = nullptr;
+  if (!ring || ring_owner != this) {
+    ring = std::make_shared<LogRing>(ring_capacity_);
+    ring_owner = this;
+    std::unique_lock<std::mutex> _(rings_lock_);
+    rings_.push_back(ring);
+  }
+  return *ring;
+}
+
+void AsyncLogger::write(int level, uint16_t format_id, const double *args, size_t arg_count) {
+  LogRecord record;
+  record.timestamp_ns = steady_now_ns();
+  record.format_id = format_id;
+  record.level = static_cast<uint8_t>(level);
+  record.arg_count = static_cast<uint8_t>(arg_count);
+  record.flags = 0;
+  std::copy(args, args + arg_count, record.args);
+  thread_ring().try_push(record);
+}
+
+void AsyncLogger::write_text(int level, const std::string &s) {
+  // Text is split over as many records as needed, all but the last one are flagged as continued
+  auto timestamp_ns = steady_now_ns();
+  auto count = std::max<size_t>(1, (s.size() + LogRecord::MaxText - 1) / LogRecord::MaxText);
+  thread_ring().try_push_all(count, [&](LogRecord &record, size_t i) {
+    auto offset = i * LogRecord::MaxText;
+    auto size = std::min(s.size() - offset, LogRecord::MaxText);
+    record.timestamp_ns = timestamp_ns;
+    record.format_id = LogRecord::TextFormat;
+    record.level = static_cast<uint8_t>(level);
+    record.arg_count = static_cast<uint8_t>(size);
+    record.flags = i + 1 < count ? LogRecord::FlagContinued : 0;
+    std::memcpy(record.text, s.data() + offset, size);
+  });
+}
+
+void AsyncLogger::set_console(std::function<void(const std::string&)> console) {
+  std::unique_lock<std::mutex> _(sinks_lock_);
+  console_ = std::move(console);
+}
+
+void AsyncLogger::set_log_file(const File &file, int64 max_bytes, int max_files) {
+  std::unique_lock<std::mutex> _(sinks_lock_);
+  log_stream_.reset();
+  log_file_ = file;
+  log_file_max_bytes_ = max_bytes;
+  log_file_max_count_ = std::max(2, max_files);
+  if (log_file_ != File()) {
+    log_file_.getParentDirectory().createDirectory();
+    // Appends to an existing file
+    log_stream_ = std::make_unique<FileOutputStream>(log_file_);
+  }
+}
+
+void AsyncLogger::consumer_thread() {
+  std::unique_lock<std::mutex> lock(quit_lock_);
+  while (!quit_) {
+    // Producers never notify, waking up periodically keeps the write path wait-free
+    quit_cv_.wait_for(lock, std::chrono::milliseconds(20));
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+  // Whatever was written before the quit
+  lock.unlock();
+  drain();
+}
+
+void AsyncLogger::drain() {
+  std::vector<std::shared_ptr<LogRing>> rings;
+  {
+    std::unique_lock<std::mutex> _(rings_lock_);
+    // Rings whose thread exited are only referenced from here
+    rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const std::shared_ptr<LogRing> &ring) {
+      return ring.use_count() == 1 && ring->empty();
+    }), rings_.end());
+    rings = rings_;
+  }
+
+  size_t dropped = 0;
+  for (auto &ring : rings) {
+    batch_.clear();
+    LogRecord record;
+    while (batch_.size() < ring_capacity_ && ring->try_pop(record)) {
+      batch_.push_back(record);
+    }
+    dropped += ring->take_dropped();
+
+    for (auto &r : batch_) {
+      if (r.format_id == LogRecord::TextFormat) {
+        // A message may still be cut by the batch size, its text waits in its own ring
+        ring->pending_text.append(r.text, r.arg_count);
+        if (r.flags & LogRecord::FlagContinued) {
+          continue;
+        }
+        emit(format_record(r, ring->pending_text));
+        ring->pending_text.clear();
+      } else {
+        emit(format_record(r, {}));
+      }
+    }
+  }
+  if (dropped > 0) {
+    emit("LOG: " + std::to_string(dropped) + " messages dropped");
+  }
+}
+
+std::string AsyncLogger::format_record(const LogRecord &record, const std::string &text) const {
+  std::string message;
+  if (record.format_id == LogRecord::TextFormat) {
+    message = text;
+  } else {
+    std::string format;
+    {
+      std::unique_lock<std::mutex> _(formats_lock_);
+      format = record.format_id < formats_.size() ? formats_[record.format_id] : "<unknown format>";
+    }
+    char buf[512];
+    const auto &a = record.args;
+    std::snprintf(buf, sizeof(buf), format.c_str(), a[0], a[1], a[2], a[3], a[4], a[5]);
+    message = buf;
+  }
+
+  auto wall_ns = record.timestamp_ns + system_clock_offset_ns_;
+  std::time_t seconds = static_cast<std::time_t>(wall_ns / 1000000000);
+  char time_str[64];
+  auto n = std::strftime(time_str, sizeof(time_str), "%Y-%m-%dT%H:%M:%S.", std::localtime(&seconds));
+  std::snprintf(time_str + n, sizeof(time_str) - n, "%09lld", static_cast<long long>(wall_ns % 1000000000));
+
+  char prefix[96];
+  std::snprintf(prefix, sizeof(prefix), "LOG(%02d) %s ", record.level, time_str);
+  return prefix + message;
+}
+
+void AsyncLogger::emit(const std::string &line) {
+  std::unique_lock<std::mutex> _(sinks_lock_);
+  if (console_) {
+    console_(line);
+  }
+  if (log_stream_) {
+    log_stream_->writeText(line + "\n", false, false, nullptr);
+    if (log_stream_->getPosition() >= log_file_max_bytes_) {
+      rotate_log_file();
+    }
+  }
+}
+
+void AsyncLogger::rotate_log_file() {
+  log_stream_.reset();
+  auto rotated = [this](int i) {
+    return log_file_.getSiblingFile(log_file_.getFileName() + "." + String(i));
+  };
+  rotated(log_file_max_count_ - 1).deleteFile();
+  for (int i = log_file_max_count_ - 2; i >= 1; i--) {
+    rotated(i).moveFileTo(rotated(i + 1));
+  }
+  log_file_.moveFileTo(rotated(1));
+  log_stream_ = std::make_unique<FileOutputStream>(log_file_);
+}
+
+#if JUCE_UNIT_TESTS
+class AsyncLoggerTest : public UnitTest {
+ public:
+  AsyncLoggerTest() : UnitTest("AsyncLogger", "loudmon") {}
+
+  void runTest() override {
+    beginTest("Multi-record messages from two producers into full rings");
+    std::mutex lines_lock;
+    std::vector<std::string> lines;
+    {
+      AsyncLogger logger;
+      logger.set_console([&](const std::string &line) {
+        std::unique_lock<std::mutex> _(lines_lock);
+        lines.push_back(line);
+      });
+      // Many times what the rings hold between two drains
+      auto producer = [&logger](char tag) {
+        for (int i = 0; i < MessageCount; i++) {
+          logger.write_text(LogLevelDefault, message(tag, i));
+        }
+      };
+      std::thread a(producer, 'a');
+      std::thread b(producer, 'b');
+      a.join();
+      b.join();
+    }
+
+    size_t dropped = 0;
+    int received[2] = {0, 0};
+    int last[2] = {-1, -1};
+    for (auto &line : lines) {
+      if (line.rfind("LOG: ", 0) == 0) {
+        dropped += std::stoul(line.substr(5));
+        continue;
+      }
+      // LOG(level) timestamp message
+      auto text = line.substr(line.find(' ', line.find(' ') + 1) + 1);
+      auto tag = text[0];
+      expect(tag == 'a' || tag == 'b', "Unknown message " + text);
+      if (tag != 'a' && tag != 'b') {
+        continue;
+      }
+      auto i = std::stoi(text.substr(1));
+      expectEquals(String(text), String(message(tag, i)));
+      expectGreaterThan(i, last[tag - 'a']);
+      last[tag - 'a'] = i;
+      received[tag - 'a']++;
+    }
+    expectGreaterThan(static_cast<int>(dropped), 0, "The rings never filled up");
+    expectEquals(static_cast<int>(dropped) + received[0] + received[1], 2 * MessageCount);
+  }
+
+ private:
+  static constexpr int MessageCount = 4000;
+
+  // Spans several records, all of them full of the producer's tag
+  static std::string message(char tag, int i) {
+    return tag + std::to_string(i) + ":" + std::string(5 * LogRecord::MaxText, tag);
+  }
+};
+
+static AsyncLoggerTest async_logger_test;
+#endif
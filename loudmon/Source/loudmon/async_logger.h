@@ -0,0 +1,161 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compact binary log record. Callers only fill one of these into their own thread's ring,
+//  formatting happens in the logger thread.
+struct LogRecord {
+  static constexpr size_t MaxArgs = 6;
+  static constexpr size_t MaxText = MaxArgs * sizeof(double);
+  // Record carries a chunk of a plain text message instead of arguments
+  static constexpr uint16_t TextFormat = 0;
+  static constexpr uint8_t FlagContinued = 1;
+
+  int64_t timestamp_ns;
+  uint16_t format_id;
+  uint8_t level;
+  uint8_t arg_count;
+  uint8_t flags;
+  union {
+    double args[MaxArgs];
+    char text[MaxText];
+  };
+};
+
+// Single producer single consumer ring, one per logging thread
+class LogRing {
+ public:
+  explicit LogRing(size_t capacity);
+  bool try_push(const LogRecord &record) {
+    return try_push_all(1, [&record](LogRecord &slot, size_t) { slot = record; });
+  }
+  // Pushes count records filled by fill(slot, index), all of them or none. The consumer sees
+  //  them at once, so a message split over several records is never half published.
+  //  A message that does not fit is counted as dropped.
+  template <typename Fill>
+  bool try_push_all(size_t count, Fill fill) {
+    auto head = head_.load(std::memory_order_relaxed);
+    auto tail = tail_.load(std::memory_order_acquire);
+    if (count > mask_ + 1 - (head - tail)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+      fill(records_[(head + i) & mask_], i);
+    }
+    head_.store(head + count, std::memory_order_release);
+    return true;
+  }
+  bool try_pop(LogRecord &record);
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+  // Messages, not records
+  size_t take_dropped() {
+    return dropped_.exchange(0, std::memory_order_relaxed);
+  }
+
+  // Consumer thread only: the text of a message whose last record is not drained yet
+  std::string pending_text;
+
+ private:
+  std::vector<LogRecord> records_;
+  size_t mask_;
+  alignas(64) std::atomic<size_t> head_ = 0;
+  alignas(64) std::atomic<size_t> tail_ = 0;
+  std::atomic<size_t> dropped_ = 0;
+};
+
+class AsyncLogger {
+ public:
+  static AsyncLogger &instance();
+  ~AsyncLogger();
+
+  // Messages with a level higher than this are dropped at the call site
+  static int get_level() {
+    return level_.load(std::memory_order_relaxed);
+  }
+  static void set_level(int level) {
+    level_.store(level, std::memory_order_relaxed);
+  }
+
+  // printf style format with only floating point conversions, every argument is passed as a double.
+  //  Register once (e.g. in a function local static) and log with the returned id.
+  uint16_t register_format(const std::string &format);
+
+  void write(int level, uint16_t format_id, const double *args, size_t arg_count);
+  void write_text(int level, const std::string &s);
+
+  // Sinks are called from the logger thread
+  void set_console(std::function<void(const std::string&)> console);
+  // Rotates to file.1 ... file.(max_files-1) once the file grows over max_bytes. An empty file disables it.
+  void set_log_file(const File &file, int64 max_bytes = 16 << 20, int max_files = 4);
+
+ private:
+  AsyncLogger();
+  friend class AsyncLoggerTest;
+  LogRing &thread_ring();
+  void consumer_thread();
+  void drain();
+  std::string format_record(const LogRecord &record, const std::string &text) const;
+  void emit(const std::string &line);
+  void rotate_log_file();
+
+ private:
+  static std::atomic<int> level_;
+  const size_t ring_capacity_ = 4096;
+
+  std::mutex rings_lock_;
+  std::vector<std::shared_ptr<LogRing>> rings_;
+
+  mutable std::mutex formats_lock_;
+  std::vector<std::string> formats_;
+
+  std::mutex sinks_lock_;
+  std::function<void(const std::string&)> console_;
+  File log_file_;
+  std::unique_ptr<FileOutputStream> log_stream_;
+  int64 log_file_max_bytes_ = 0;
+  int log_file_max_count_ = 0;
+
+  // steady clock -> wall clock, for the timestamps of the formatted lines
+  int64_t system_clock_offset_ns_;
+  std::vector<LogRecord> batch_;
+  bool quit_ = false;
+  std::mutex quit_lock_;
+  std::condition_variable quit_cv_;
+  std::thread consumer_;
+};
+
+constexpr int LogLevelDefault = 5;
+// Per block/per bin output, off unless enabled from the debug menu
+constexpr int LogLevelVerbose = 10;
+
+inline bool log_enabled(int level) {
+  return level <= AsyncLogger::get_level();
+}
+
+// When the level is disabled, a log call costs only the branch
+template <typename... Args>
+inline void log(int level, uint16_t format_id, Args... args) {
+  static_assert(sizeof...(Args) <= LogRecord::MaxArgs, "Too many log arguments");
+  if (log_enabled(level)) {
+    double values[sizeof...(Args) + 1] = {static_cast<double>(args)...};
+    AsyncLogger::instance().write(level, format_id, values, sizeof...(Args));
+  }
+}
+
+inline void log(int level, const std::string &s) {
+  if (log_enabled(level)) {
+    AsyncLogger::instance().write_text(level, s);
+  }
+}
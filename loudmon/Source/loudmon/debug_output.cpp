@@ -1,58 +1,164 @@
 #include "debug_output.h"
 
-#include <iostream>
+// Only the first debug window receives the log output
 static DebugOutputComponent* the_main_logger = nullptr;
-void log(int level, const std::string &s) {
-  if (the_main_logger) {
-    std::stringstream ss;
-
-    std::string time_str(29, '0');
-    char* buf = &time_str[0];
-    auto point = std::chrono::system_clock::now();
-    std::time_t now_c = std::chrono::system_clock::to_time_t(point);
-    std::strftime(buf, 21, "%Y-%m-%dT%H:%M:%S.", std::localtime(&now_c));
-#ifdef JUCE_MSVC
-    sprintf(buf + 20, "%09lld", point.time_since_epoch().count() % 1000000000);
-#else
-    sprintf(buf + 20, "%09ld", point.time_since_epoch().count() % 1000000000);
-#endif
-    ss << "LOG(" << std::setw(2) << std::setfill('0') << level << ") " << time_str << " " << s;
-    the_main_logger->print_line(ss.str());
-  }
-}
-
-DebugOutputComponent::DebugOutputComponent() :mono_font(juce::Font::getDefaultMonospacedFontName(), 20, Font::plain) {
+
+LineArena::LineArena(size_t max_lines, size_t lines_per_chunk, size_t chunk_bytes)
+    :lines_per_chunk_(lines_per_chunk),
+     chunk_bytes_(chunk_bytes),
+     max_chunks_((max_lines + lines_per_chunk - 1) / lines_per_chunk + 1) {
+  start_new_chunk();
+}
+
+void LineArena::start_new_chunk() {
+  // The ring grows up to max_chunks_ while the oldest chunk is still the first one,
+  //  the buffers grow with the lines and keep their capacity once they are reused
+  if (chunk_count_ == chunks_.size() && chunks_.size() < max_chunks_) {
+    chunks_.emplace_back();
+  } else if (chunk_count_ == chunks_.size()) {
+    oldest_chunk_ = (oldest_chunk_ + 1) % chunks_.size();
+    chunk_count_--;
+  }
+  auto &chunk = chunks_[(oldest_chunk_ + chunk_count_) % chunks_.size()];
+  chunk_count_++;
+  chunk.first_line = end_line_;
+  chunk.data.clear();
+  chunk.offsets.clear();
+  chunk.offsets.push_back(0);
+}
+
+void LineArena::push(std::string_view line) {
+  line = line.substr(0, chunk_bytes_);
+  auto *chunk = &chunks_[(oldest_chunk_ + chunk_count_ - 1) % chunks_.size()];
+  if (chunk->offsets.size() > lines_per_chunk_ || chunk->data.size() + line.size() > chunk_bytes_) {
+    start_new_chunk();
+    chunk = &chunks_[(oldest_chunk_ + chunk_count_ - 1) % chunks_.size()];
+  }
+  chunk->data.insert(chunk->data.end(), line.begin(), line.end());
+  chunk->offsets.push_back(static_cast<uint32_t>(chunk->data.size()));
+  end_line_++;
+}
+
+size_t LineArena::first_line() const {
+  return chunk_at(0).first_line;
+}
+
+std::string_view LineArena::get(size_t line) const {
+  if (line < first_line() || line >= end_line_) {
+    return {};
+  }
+  // Chunks are ordered by their first line
+  size_t lo = 0, hi = chunk_count_;
+  while (hi - lo > 1) {
+    auto mid = (lo + hi) / 2;
+    if (chunk_at(mid).first_line <= line) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  auto &chunk = chunk_at(lo);
+  auto index = line - chunk.first_line;
+  return {chunk.data.data() + chunk.offsets[index], chunk.offsets[index + 1] - chunk.offsets[index]};
+}
+
+DebugOutputComponent::DebugOutputComponent()
+    :mono_font(juce::Font::getDefaultMonospacedFontName(), 20, Font::plain),
+     lines(max_line_count) {
   if (the_main_logger == nullptr) {
     the_main_logger = this;
+    AsyncLogger::instance().set_console([this](const std::string &line) {
+      print_line(line);
+    });
   }
+  scroll_bar_.setAutoHide(false);
+  scroll_bar_.addListener(this);
+  addAndMakeVisible(scroll_bar_);
   setSize(400, 200);
   startTimer(50);
 }
 DebugOutputComponent::~DebugOutputComponent() {
-  the_main_logger = nullptr;
+  if (the_main_logger == this) {
+    // Waits for a line that is being printed right now
+    AsyncLogger::instance().set_console(nullptr);
+    the_main_logger = nullptr;
+  }
 }
 void DebugOutputComponent::print_line(const std::string &s) {
   std::unique_lock<std::mutex> _(lines_lock);
-  lines.push_back(s);
-  if (lines.size() > max_line_count) {
-    lines.pop_front();
-  }
+  lines.push(s);
+  lines_version_.fetch_add(1, std::memory_order_release);
 }
 void DebugOutputComponent::timerCallback() {
+  auto version = lines_version_.load(std::memory_order_acquire);
+  if (version == painted_version_) {
+    return;
+  }
+  painted_version_ = version;
+  update_scroll_range();
   repaint();
 }
+size_t DebugOutputComponent::visible_line_count() const {
+  return static_cast<size_t>(std::max(1, static_cast<int>((getHeight() - 20) / mono_font.getHeight())));
+}
+void DebugOutputComponent::update_scroll_range() {
+  size_t first, end;
+  {
+    std::unique_lock<std::mutex> _(lines_lock);
+    first = lines.first_line();
+    end = lines.end_line();
+  }
+  auto visible = static_cast<double>(visible_line_count());
+  scroll_bar_.setRangeLimits(static_cast<double>(first), std::max(static_cast<double>(end), first + visible), dontSendNotification);
+  scroll_bar_.setCurrentRangeSize(visible, dontSendNotification);
+  if (follow_tail_) {
+    scroll_bar_.scrollToBottom(dontSendNotification);
+  }
+}
+void DebugOutputComponent::scrollBarMoved(ScrollBar *, double) {
+  // Scrolling back to the end resumes following new lines
+  follow_tail_ = scroll_bar_.getCurrentRange().getEnd() >= scroll_bar_.getMaximumRangeLimit();
+  repaint();
+}
+void DebugOutputComponent::mouseWheelMove(const MouseEvent &event, const MouseWheelDetails &wheel) {
+  scroll_bar_.mouseWheelMove(event, wheel);
+}
+void DebugOutputComponent::resized() {
+  const int scroll_bar_width = 12;
+  scroll_bar_.setBounds(getWidth() - scroll_bar_width, 0, scroll_bar_width, getHeight());
+  update_scroll_range();
+}
 void DebugOutputComponent::paint(Graphics &g) {
-  std::stringstream ss;
+  g.fillAll(Colours::black);
+  g.setColour(juce::Colour::fromRGB(248, 248, 248));
+
+  // Only the rows on screen are laid out, and each of them only once while it stays on screen
+  auto first_visible = static_cast<size_t>(scroll_bar_.getCurrentRangeStart());
+  auto end_visible = first_visible + visible_line_count();
+  for (auto it = glyph_cache_.begin(); it != glyph_cache_.end();) {
+    if (it->first < first_visible || it->first >= end_visible) {
+      it = glyph_cache_.erase(it);
+    } else {
+      ++it;
+    }
+  }
   {
     std::unique_lock<std::mutex> _(lines_lock);
-    ss << "output: " << std::endl;
-    for (auto &line : lines) {
-      ss << line << std::endl;
+    end_visible = std::min(end_visible, lines.end_line());
+    for (auto line = first_visible; line < end_visible; line++) {
+      if (glyph_cache_.find(line) == glyph_cache_.end()) {
+        auto text = lines.get(line);
+        GlyphArrangement glyphs;
+        glyphs.addLineOfText(mono_font, String::fromUTF8(text.data(), static_cast<int>(text.size())), 0, 0);
+        glyph_cache_.emplace(line, std::move(glyphs));
+      }
     }
   }
 
-  g.fillAll(Colours::black);
-  g.setFont(mono_font);
-  g.setColour(juce::Colour::fromRGB(248, 248, 248));
-  g.drawMultiLineText(ss.str(), 10, 10, getWidth() - 20);
+  const float line_height = mono_font.getHeight();
+  g.reduceClipRegion(0, 0, scroll_bar_.getX(), getHeight());
+  for (auto line = first_visible; line < end_visible; line++) {
+    auto y = 10 + mono_font.getAscent() + static_cast<float>(line - first_visible) * line_height;
+    glyph_cache_[line].draw(g, AffineTransform::translation(10, y));
+  }
 }
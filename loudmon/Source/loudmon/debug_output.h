@@ -1,30 +1,84 @@
 #pragma once
 
-#include <list>
+#include <string_view>
+#include <unordered_map>
 #include <JuceHeader.h>
+#include "async_logger.h"
 
-class DebugOutputComponent :public Component, public juce::Timer {
+// Scrollback storage. Lines are packed into a ring of chunks whose buffers are reused,
+//  the oldest chunk is dropped as a whole once the ring is full. At least max_lines are kept
+//  as long as lines average under chunk_bytes / lines_per_chunk. Chunks are only allocated
+//  as lines arrive, a quiet console costs next to nothing.
+class LineArena {
+ public:
+  LineArena(size_t max_lines, size_t lines_per_chunk = 1024, size_t chunk_bytes = 128 << 10);
+
+  void push(std::string_view line);
+  // Global index of the oldest line that is still kept
+  size_t first_line() const;
+  // One past the global index of the newest line
+  size_t end_line() const {
+    return end_line_;
+  }
+  // Valid until the next push
+  std::string_view get(size_t line) const;
+
+ private:
+  struct Chunk {
+    size_t first_line = 0;
+    std::vector<char> data;
+    std::vector<uint32_t> offsets;
+  };
+  const Chunk &chunk_at(size_t logical_index) const {
+    return chunks_[(oldest_chunk_ + logical_index) % chunks_.size()];
+  }
+  void start_new_chunk();
+
+  size_t lines_per_chunk_;
+  size_t chunk_bytes_;
+  size_t max_chunks_;
+  std::vector<Chunk> chunks_;
+  size_t oldest_chunk_ = 0;
+  size_t chunk_count_ = 0;
+  size_t end_line_ = 0;
+};
+
+class DebugOutputComponent :public Component, public juce::Timer, public juce::ScrollBar::Listener {
  public:
   DebugOutputComponent();
   ~DebugOutputComponent() override;
   void print_line(const std::string& s);
   void timerCallback() override;
   void paint (Graphics& g) override;
+  void resized() override;
+  void mouseWheelMove(const MouseEvent &event, const MouseWheelDetails &wheel) override;
+  void scrollBarMoved(ScrollBar *scroll_bar, double new_range_start) override;
+
+ private:
+  size_t visible_line_count() const;
+  void update_scroll_range();
+
  private:
   Font mono_font;
-  size_t max_line_count = 16;
-  std::list<std::string> lines;
+  size_t max_line_count = 100000;
+  LineArena lines;
   std::mutex lines_lock;
+  // Bumped for every new line, so that the timer can skip repaints when nothing changed
+  std::atomic<size_t> lines_version_ = 0;
+  size_t painted_version_ = 0;
+
+  ScrollBar scroll_bar_{true};
+  bool follow_tail_ = true;
+  // Glyphs of the lines that are currently on screen, keyed by global line index
+  std::unordered_map<size_t, GlyphArrangement> glyph_cache_;
 };
 
 class DebugOutputWindow :public DocumentWindow {
  public:
   DebugOutputWindow(const String& name, Colour backgroundColour, int buttonsNeeded) :DocumentWindow(name, backgroundColour, buttonsNeeded) {
-    setContentOwned(&comp, true);
+    setContentNonOwned(&comp, true);
   }
 
  private:
   DebugOutputComponent comp;
 };
-
-void log(int level, const std::string& s);
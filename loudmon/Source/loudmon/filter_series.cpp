@@ -0,0 +1,59 @@
+#include "filter_series.h"
+
+#include <algorithm>
+#include <cmath>
+
+Biquad design_band(const BandParameters &band, double sample_rate) {
+  auto nyquist = sample_rate / 2;
+  auto frequency = std::clamp(static_cast<double>(band.frequency), 1.0, nyquist * 0.999);
+  auto quality = std::max(static_cast<double>(band.quality), 0.01);
+  const double pi = 3.14159265358979323846;
+  auto w0 = 2 * pi * frequency / sample_rate;
+  auto cw = std::cos(w0), sw = std::sin(w0);
+  auto alpha = sw / (2 * quality);
+  auto a = std::pow(10.0, band.gain_db / 40.0);
+  auto shelf = 2 * std::sqrt(a) * alpha;
+
+  double b0, b1, b2, a0, a1, a2;
+  switch (band.type) {
+    case BandType::Bell:
+      b0 = 1 + alpha * a; b1 = -2 * cw; b2 = 1 - alpha * a;
+      a0 = 1 + alpha / a; a1 = -2 * cw; a2 = 1 - alpha / a;
+      break;
+    case BandType::LowShelf:
+      b0 = a * ((a + 1) - (a - 1) * cw + shelf);
+      b1 = 2 * a * ((a - 1) - (a + 1) * cw);
+      b2 = a * ((a + 1) - (a - 1) * cw - shelf);
+      a0 = (a + 1) + (a - 1) * cw + shelf;
+      a1 = -2 * ((a - 1) + (a + 1) * cw);
+      a2 = (a + 1) + (a - 1) * cw - shelf;
+      break;
+    case BandType::HighShelf:
+      b0 = a * ((a + 1) + (a - 1) * cw + shelf);
+      b1 = -2 * a * ((a - 1) + (a + 1) * cw);
+      b2 = a * ((a + 1) + (a - 1) * cw - shelf);
+      a0 = (a + 1) - (a - 1) * cw + shelf;
+      a1 = 2 * ((a - 1) - (a + 1) * cw);
+      a2 = (a + 1) - (a - 1) * cw - shelf;
+      break;
+    case BandType::HighPass:
+      b0 = (1 + cw) / 2; b1 = -(1 + cw); b2 = (1 + cw) / 2;
+      a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+      break;
+    case BandType::LowPass:
+      b0 = (1 - cw) / 2; b1 = 1 - cw; b2 = (1 - cw) / 2;
+      a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+      break;
+    case BandType::BandPass:
+      b0 = alpha; b1 = 0; b2 = -alpha;
+      a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+      break;
+    case BandType::Notch:
+    default:
+      b0 = 1; b1 = -2 * cw; b2 = 1;
+      a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+      break;
+  }
+  return {static_cast<float>(b0 / a0), static_cast<float>(b1 / a0), static_cast<float>(b2 / a0),
+          static_cast<float>(a1 / a0), static_cast<float>(a2 / a0)};
+}
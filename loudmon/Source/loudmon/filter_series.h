@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Transposed direct form II, normalized by a0
+struct Biquad {
+  float b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+};
+
+enum class BandType {
+  Bell,
+  LowShelf,
+  HighShelf,
+  HighPass,
+  LowPass,
+  Notch,
+  // 0 dB at the center
+  BandPass,
+};
+
+struct BandParameters {
+  BandType type = BandType::Bell;
+  float frequency = 1000;
+  float quality = 0.707f;
+  // Bell and shelves only
+  float gain_db = 0;
+  bool enabled = false;
+};
+
+// Bilinear-transform designs (RBJ cookbook), frequencies are clamped into (0, nyquist)
+Biquad design_band(const BandParameters &band, double sample_rate);
+
+// |H(e^jw)|^2 = |b0 + b1 e^-jw + b2 e^-2jw|^2 / |1 + a1 e^-jw + a2 e^-2jw|^2
+inline float biquad_power(const Biquad &c, float cos_w, float sin_w, float cos_2w, float sin_2w) {
+  auto num_re = c.b0 + c.b1 * cos_w + c.b2 * cos_2w;
+  auto num_im = c.b1 * sin_w + c.b2 * sin_2w;
+  auto den_re = 1 + c.a1 * cos_w + c.a2 * cos_2w;
+  auto den_im = c.a1 * sin_w + c.a2 * sin_2w;
+  return (num_re * num_re + num_im * num_im) / (den_re * den_re + den_im * den_im);
+}
+
+constexpr size_t FilterSeriesMaxBands = 12;
+
+struct SeriesCoefficients {
+  std::array<Biquad, FilterSeriesMaxBands> bands;
+  // Bit i is set when band i runs
+  uint32_t active_mask = 0;
+
+  bool is_active(size_t band) const {
+    return (active_mask >> band) & 1u;
+  }
+};
+
+/* Biquads in series, e.g. the bands of a parametric EQ. Channels are processed side by side in
+ * SIMD lanes: a block is interleaved into a scratch buffer once, then every band runs over it with
+ * all its lanes' states in one contiguous array. Inactive bands are not in the run list at all.
+ * The lane count follows the channel count, a mono or stereo series does not filter silent lanes. */
+template <typename T>
+class FilterSeries {
+ public:
+  static constexpr size_t MaxLanes = 4;
+
+  // Allocates for up to channels channels and blocks of max_block samples, and resets
+  void prepare(size_t channels, size_t max_block) {
+    lanes_ = channels <= 1 ? 1 : channels == 2 ? 2 : MaxLanes;
+    lane_groups_ = (channels + lanes_ - 1) / lanes_;
+    state_.assign(lane_groups_ * FilterSeriesMaxBands * 2 * lanes_, 0);
+    scratch_.assign(max_block * lanes_, 0);
+    max_block_ = max_block;
+  }
+  void reset() {
+    std::fill(state_.begin(), state_.end(), T(0));
+  }
+
+  // Takes effect at the next process call, the coefficients are ramped over that block.
+  //  Bands that start or stop running ramp from or to a pass-through.
+  void set_coefficients(const SeriesCoefficients &coefficients) {
+    if (!ramp_ && std::memcmp(&coefficients, &current_, sizeof(SeriesCoefficients)) == 0) {
+      return;
+    }
+    target_ = coefficients;
+    ramp_ = true;
+  }
+  // Takes effect immediately
+  void set_coefficients_now(const SeriesCoefficients &coefficients) {
+    current_ = target_ = coefficients;
+    ramp_ = false;
+  }
+
+  void process(T *const *channels, size_t channel_count, size_t num_samples) {
+    switch (lanes_) {
+      case 1:
+        process_lanes<1>(channels, channel_count, num_samples);
+        break;
+      case 2:
+        process_lanes<2>(channels, channel_count, num_samples);
+        break;
+      default:
+        process_lanes<MaxLanes>(channels, channel_count, num_samples);
+        break;
+    }
+  }
+
+ private:
+  template <size_t Lanes>
+  void process_lanes(T *const *channels, size_t channel_count, size_t num_samples) {
+    num_samples = std::min(num_samples, max_block_);
+    channel_count = std::min(channel_count, lane_groups_ * Lanes);
+    if (num_samples == 0 || channel_count == 0) {
+      return;
+    }
+    auto run_mask = ramp_ ? current_.active_mask | target_.active_mask : current_.active_mask;
+    size_t run_count = 0;
+    for (size_t band = 0; band < FilterSeriesMaxBands; band++) {
+      if ((run_mask >> band) & 1u) {
+        run_list_[run_count++] = static_cast<uint8_t>(band);
+      }
+    }
+
+    for (size_t group = 0; group * Lanes < channel_count; group++) {
+      auto lanes = std::min(Lanes, channel_count - group * Lanes);
+      for (size_t i = 0; i < num_samples; i++) {
+        for (size_t lane = 0; lane < Lanes; lane++) {
+          scratch_[i * Lanes + lane] = lane < lanes ? channels[group * Lanes + lane][i] : T(0);
+        }
+      }
+      for (size_t k = 0; k < run_count; k++) {
+        auto band = run_list_[k];
+        auto state = &state_[(group * FilterSeriesMaxBands + band) * 2 * Lanes];
+        if (ramp_) {
+          Biquad pass_through;
+          auto &from = current_.is_active(band) ? current_.bands[band] : pass_through;
+          auto &to = target_.is_active(band) ? target_.bands[band] : pass_through;
+          run_band_ramp<Lanes>(from, to, state, num_samples);
+        } else {
+          run_band<Lanes>(current_.bands[band], state, num_samples);
+        }
+      }
+      for (size_t i = 0; i < num_samples; i++) {
+        for (size_t lane = 0; lane < lanes; lane++) {
+          channels[group * Lanes + lane][i] = scratch_[i * Lanes + lane];
+        }
+      }
+    }
+
+    if (ramp_) {
+      // Bands that stopped running start from silence when they come back
+      auto stopped = current_.active_mask & ~target_.active_mask;
+      for (size_t group = 0; group < lane_groups_; group++) {
+        for (size_t band = 0; band < FilterSeriesMaxBands; band++) {
+          if ((stopped >> band) & 1u) {
+            auto state = state_.begin() + static_cast<std::ptrdiff_t>((group * FilterSeriesMaxBands + band) * 2 * Lanes);
+            std::fill(state, state + 2 * Lanes, T(0));
+          }
+        }
+      }
+      current_ = target_;
+      ramp_ = false;
+    }
+  }
+
+  template <size_t Lanes>
+  void run_band(const Biquad &c, T *state, size_t num_samples) {
+    T b0 = c.b0, b1 = c.b1, b2 = c.b2, a1 = c.a1, a2 = c.a2;
+    T s1[Lanes], s2[Lanes];
+    std::copy(state, state + Lanes, s1);
+    std::copy(state + Lanes, state + 2 * Lanes, s2);
+    auto data = scratch_.data();
+    for (size_t i = 0; i < num_samples; i++) {
+      for (size_t lane = 0; lane < Lanes; lane++) {
+        auto in = data[i * Lanes + lane];
+        auto out = b0 * in + s1[lane];
+        s1[lane] = b1 * in - a1 * out + s2[lane];
+        s2[lane] = b2 * in - a2 * out;
+        data[i * Lanes + lane] = out;
+      }
+    }
+    std::copy(s1, s1 + Lanes, state);
+    std::copy(s2, s2 + Lanes, state + Lanes);
+  }
+
+  // Linear in the coefficients, reaching to at the last sample
+  template <size_t Lanes>
+  void run_band_ramp(const Biquad &from, const Biquad &to, T *state, size_t num_samples) {
+    auto step = T(1) / static_cast<T>(num_samples);
+    T b0 = from.b0, b1 = from.b1, b2 = from.b2, a1 = from.a1, a2 = from.a2;
+    T db0 = (to.b0 - b0) * step, db1 = (to.b1 - b1) * step, db2 = (to.b2 - b2) * step;
+    T da1 = (to.a1 - a1) * step, da2 = (to.a2 - a2) * step;
+    T s1[Lanes], s2[Lanes];
+    std::copy(state, state + Lanes, s1);
+    std::copy(state + Lanes, state + 2 * Lanes, s2);
+    auto data = scratch_.data();
+    for (size_t i = 0; i < num_samples; i++) {
+      b0 += db0; b1 += db1; b2 += db2; a1 += da1; a2 += da2;
+      for (size_t lane = 0; lane < Lanes; lane++) {
+        auto in = data[i * Lanes + lane];
+        auto out = b0 * in + s1[lane];
+        s1[lane] = b1 * in - a1 * out + s2[lane];
+        s2[lane] = b2 * in - a2 * out;
+        data[i * Lanes + lane] = out;
+      }
+    }
+    std::copy(s1, s1 + Lanes, state);
+    std::copy(s2, s2 + Lanes, state + Lanes);
+  }
+
+ private:
+  SeriesCoefficients current_, target_;
+  bool ramp_ = false;
+  std::array<uint8_t, FilterSeriesMaxBands> run_list_{};
+
+  size_t lanes_ = 1;
+  size_t lane_groups_ = 0;
+  size_t max_block_ = 0;
+  // [lane group][band][s1, s2][lane]
+  std::vector<T> state_;
+  // [sample][lane]
+  std::vector<T> scratch_;
+};
@@ -1,18 +1,20 @@
 #include "filter_ui.h"
 
 #include "utils.h"
+#include "../common/meter_kernels.h"
 
-FilterTransferFunctionComponent::FilterTransferFunctionComponent(float sample_rate, size_t input_channels, size_t fft_order)
-    :sample_rate_(sample_rate),
-     input_channels_(input_channels),
-     fft_order_(fft_order), fft_size_((size_t)1 << fft_order),
-     forward_fft(static_cast<int>(fft_order)),
-     spectrum_(1, static_cast<int>(fft_size_*2)),
+FilterTransferFunctionComponent::FilterTransferFunctionComponent(MainFilter &main_filter, float sample_rate)
+    :main_filter_(main_filter),
+     sample_rate_(sample_rate),
      frequency_slider_("Frequency"),
      quality_slider_("Q"),
-     filters_(input_channels_) {
+     band_enabled_("On"),
+     band_frequency_slider_("Band Hz"),
+     band_quality_slider_("Band Q") {
 
-  set_parameters(sqrt(20.0f*20000), 1);
+  plot_.set_value_range(20, 20000, -50, 10, true, false);
+  // The filter keeps its parameters when the editor is recreated
+  set_parameters(main_filter_.frequency(), main_filter_.quality());
 
   float freq_min = 20, freq_max = sample_rate/2;
   frequency_slider_.setOnValueChange(std::bind(&FilterTransferFunctionComponent::filter_parameter_changed, this));
@@ -23,6 +25,33 @@ FilterTransferFunctionComponent::FilterTransferFunctionComponent(float sample_ra
   quality_slider_.setRangeLogarithm(0.05, 20);
   addAndMakeVisible(quality_slider_);
 
+  for (size_t band = 2; band < MainFilter::BandCount; band++) {
+    band_select_.addItem("Band " + String(static_cast<int>(band + 1)), static_cast<int>(band + 1));
+  }
+  // Item ids are the BandType values + 1
+  for (auto name : {"Bell", "Low shelf", "High shelf", "High-pass", "Low-pass", "Notch", "Band-pass"}) {
+    band_type_select_.addItem(name, band_type_select_.getNumItems() + 1);
+  }
+  band_select_.setSelectedId(3, dontSendNotification);
+  band_select_.onChange = std::bind(&FilterTransferFunctionComponent::show_band, this);
+  band_type_select_.onChange = std::bind(&FilterTransferFunctionComponent::band_parameter_changed, this);
+  band_enabled_.onClick = std::bind(&FilterTransferFunctionComponent::band_parameter_changed, this);
+  band_frequency_slider_.setRangeLogarithm(freq_min, freq_max);
+  band_frequency_slider_.setOnValueChange(std::bind(&FilterTransferFunctionComponent::band_parameter_changed, this));
+  band_quality_slider_.setRangeLogarithm(0.05, 20);
+  band_quality_slider_.setOnValueChange(std::bind(&FilterTransferFunctionComponent::band_parameter_changed, this));
+  band_gain_slider_.setSliderStyle(Slider::SliderStyle::LinearVertical);
+  band_gain_slider_.setRange(-24, 24, 0.1);
+  band_gain_slider_.setTextValueSuffix(" dB");
+  band_gain_slider_.onValueChange = std::bind(&FilterTransferFunctionComponent::band_parameter_changed, this);
+  show_band();
+  addAndMakeVisible(band_select_);
+  addAndMakeVisible(band_type_select_);
+  addAndMakeVisible(band_enabled_);
+  addAndMakeVisible(band_frequency_slider_);
+  addAndMakeVisible(band_quality_slider_);
+  addAndMakeVisible(band_gain_slider_);
+
   addAndMakeVisible(plot_);
 }
 
@@ -31,37 +60,69 @@ void FilterTransferFunctionComponent::paint(Graphics &g) {
   g.fillAll();
 }
 void FilterTransferFunctionComponent::set_parameters(float frequency, float quality) {
-  frequency_ = frequency;
-  quality_ = quality;
+  // Builds the coefficients and hands them to the audio thread without waiting for it
+  coefficients_ = main_filter_.set_parameters(frequency, quality);
+  update_response();
+}
 
-  IIRCoefficients coeffs;
-  coeffs = IIRCoefficients::makeLowPass(sample_rate_, frequency_, quality_);
+size_t FilterTransferFunctionComponent::selected_band() const {
+  return static_cast<size_t>(band_select_.getSelectedId() - 1);
+}
 
-  {
-    std::unique_lock<spinlock> _(filters_lock_);
-    for (auto &filter : filters_) {
-      filter.get<0>() = dsp::IIR::Coefficients<float>::makeHighPass(sample_rate_, std::min(frequency_*0.9f, sample_rate_/2), quality_);
-      filter.get<1>()= dsp::IIR::Coefficients<float>::makeLowPass(sample_rate_, std::min(frequency_*1.1f, sample_rate_/2), quality_);
-    }
+void FilterTransferFunctionComponent::show_band() {
+  auto band = main_filter_.band(selected_band());
+  band_type_select_.setSelectedId(static_cast<int>(band.type) + 1, dontSendNotification);
+  band_enabled_.setToggleState(band.enabled, dontSendNotification);
+  band_frequency_slider_.setValue(band.frequency, dontSendNotification);
+  band_quality_slider_.setValue(band.quality, dontSendNotification);
+  band_gain_slider_.setValue(band.gain_db, dontSendNotification);
+}
+
+void FilterTransferFunctionComponent::band_parameter_changed() {
+  BandParameters band;
+  band.type = static_cast<BandType>(band_type_select_.getSelectedId() - 1);
+  band.frequency = static_cast<float>(band_frequency_slider_.getValue());
+  band.quality = static_cast<float>(band_quality_slider_.getValue());
+  band.gain_db = static_cast<float>(band_gain_slider_.getValue());
+  band.enabled = band_enabled_.getToggleState();
+  coefficients_ = main_filter_.set_band(selected_band(), band);
+  update_response();
+}
+
+void FilterTransferFunctionComponent::update_coefficients() {
+  coefficients_ = main_filter_.coefficients();
+  update_response();
+}
+
+void FilterTransferFunctionComponent::update_response_tables() {
+  auto frequencies = plot_.pixel_column_x_values();
+  response_columns_.resize(frequencies.size());
+  response_.reserve(frequencies.size());
+  for (size_t i = 0; i < frequencies.size(); i++) {
+    auto w = 2 * MathConstants<float>::pi * frequencies[i] / sample_rate_;
+    response_columns_[i] = {frequencies[i], std::cos(w), std::sin(w), std::cos(2 * w), std::sin(2 * w)};
   }
+}
 
-  filter_for_display_.get<0>() = dsp::IIR::Coefficients<float>::makeHighPass(sample_rate_, frequency_*0.9f, quality_);
-  filter_for_display_.get<1>() = dsp::IIR::Coefficients<float>::makeLowPass(sample_rate_, std::min(frequency_*1.1f, sample_rate_/2), quality_);
-  spectrum_.clear();
-  spectrum_.setSample(0, 0, 1);
-  dsp::AudioBlock<float> audio_block(spectrum_);
-  dsp::ProcessContextReplacing<float> context_replacing(audio_block);
-  filter_for_display_.process(context_replacing);
-  forward_fft.performFrequencyOnlyForwardTransform(spectrum_.getArrayOfWritePointers()[0]);
-  for (int i = 0; i < spectrum_.getNumSamples(); i++) {
-    spectrum_.setSample(0, i, 10 * log10f(spectrum_.getSample(0, i)));
+void FilterTransferFunctionComponent::update_response() {
+  response_.clear();
+  response_power_.resize(response_columns_.size());
+  for (size_t i = 0; i < response_columns_.size(); i++) {
+    auto &column = response_columns_[i];
+    float power = 1;
+    for (size_t band = 0; band < MainFilter::BandCount; band++) {
+      if (!coefficients_.is_active(band)) {
+        continue;
+      }
+      power *= biquad_power(coefficients_.bands[band], column.cos_w, column.sin_w, column.cos_2w, column.sin_2w);
+    }
+    response_power_[i] = power;
   }
-  plot_.set_value_range(20, 20000, -50, 10, true, false);
-  plot_.clear();
-  std::vector<std::tuple<float, float>> values;
-  for (size_t i = 0; i < fft_size_/2; i++) {
-    auto y = spectrum_.getSample(0, static_cast<int>(i));
-    values.emplace_back(float(i)/fft_size_ * sample_rate_, y);
+  meter_kernels().to_db(response_power_.data(), response_power_.data(), response_power_.size(), 10, -200);
+  for (size_t i = 0; i < response_columns_.size(); i++) {
+    response_.emplace_back(response_columns_[i].frequency, response_power_[i]);
   }
-  plot_.add_new_values("spectrum", values);
+  plot_.clear();
+  plot_.add_new_values("response", response_);
+  plot_.repaint();
 }
@@ -7,81 +7,79 @@
 #include "log_slider.h"
 #include "utils.h"
 #include "plot.h"
-
-template <typename T>
-class FilterSeries {
- public:
-
-  void reset() {
-    for (auto &filter : filters_) {
-      filter.reset();
-    }
-  }
-
-  T processSample(T value) noexcept {
-    for (auto &filter : filters_) {
-      value = filter.processSample(value);
-    }
-    return value;
-  }
-
-  template <typename Context>
-  void process (Context &context) {
-    for (auto &filter : filters_) {
-      filter.template process<Context>(context);
-    }
-  }
-
-  std::vector<dsp::IIR::Filter<T>> filters_;
-};
-
+#include "main_filter.h"
 
 template<typename T>
 using PeakFilter = dsp::ProcessorChain<dsp::IIR::Filter<T>, dsp::IIR::Filter<T>>;
 
 class FilterTransferFunctionComponent :public juce::Component {
  public:
-  FilterTransferFunctionComponent(float sample_rate, size_t input_channels, size_t fft_order = 10);
+  FilterTransferFunctionComponent(MainFilter &main_filter, float sample_rate);
   void paint(Graphics &g) override;
   void paint_transfer_function(Graphics &g, float left, float top, float width, float height);
   void resized() override {
     auto area = getLocalBounds();
     auto slider_area = area.removeFromTop(static_cast<int>(slider_height_));
-    frequency_slider_.setBounds(slider_area.removeFromLeft(static_cast<int>(area.getWidth()/slider_count_)));
-    quality_slider_.setBounds(slider_area.removeFromLeft(static_cast<int>(area.getWidth()/slider_count_)));
+    auto slider_width = static_cast<int>(area.getWidth()/slider_count_);
+    frequency_slider_.setBounds(slider_area.removeFromLeft(slider_width));
+    quality_slider_.setBounds(slider_area.removeFromLeft(slider_width));
+    auto band_area = slider_area.removeFromLeft(slider_width).reduced(4);
+    auto row_height = band_area.getHeight() / 3;
+    band_select_.setBounds(band_area.removeFromTop(row_height).reduced(0, 2));
+    band_type_select_.setBounds(band_area.removeFromTop(row_height).reduced(0, 2));
+    band_enabled_.setBounds(band_area);
+    band_frequency_slider_.setBounds(slider_area.removeFromLeft(slider_width));
+    band_quality_slider_.setBounds(slider_area.removeFromLeft(slider_width));
+    band_gain_slider_.setBounds(slider_area.removeFromLeft(slider_width));
     plot_.setBounds(area);
+    update_response_tables();
+    update_response();
   }
 
   void filter_parameter_changed() {
     set_parameters(static_cast<float>(frequency_slider_.getValue()), static_cast<float>(quality_slider_.getValue()));
   }
-
-  template <typename Context>
-  void process(int channel, Context &context) {
-    std::unique_lock<spinlock> _(filters_lock_);
-    filters_[channel].process(context);
-  }
+  // From the controls of the selected band
+  void band_parameter_changed();
+  // Shows the filter's current coefficients, e.g. after its mode changed
+  void update_coefficients();
 
  private:
   void set_parameters(float frequency, float quality);
+  // Index of the band the band controls edit
+  size_t selected_band() const;
+  // Shows the parameters of the selected band in the band controls
+  void show_band();
+  // Trigonometry of the frequencies at the plot's pixel columns, only changes with the plot's size
+  void update_response_tables();
+  // Magnitude response of coefficients_, evaluated from the coefficients at every pixel column
+  void update_response();
 
  private:
+  // Owned by the processor, this only sets its parameters
+  MainFilter &main_filter_;
   float sample_rate_;
-  size_t input_channels_;
-  float frequency_ = sqrt(20 * 20000.0f), quality_ = 1.0f;
-  size_t fft_order_, fft_size_;
+  MainFilter::Coefficients coefficients_;
 
   LogSlider frequency_slider_, quality_slider_;
+  // The first two bands follow the sliders above, these edit one of the others
+  ComboBox band_select_, band_type_select_;
+  ToggleButton band_enabled_;
+  LogSlider band_frequency_slider_, band_quality_slider_;
+  juce::Slider band_gain_slider_;
   PlotComponent plot_;
-  std::vector<PeakFilter<float>> filters_;
-//  IIRFilter filter_for_display_;
-  PeakFilter<float> filter_for_display_;
-  spinlock filters_lock_;
 
-  dsp::FFT forward_fft;
-  AudioBuffer<float> spectrum_;
+  // cos(w), sin(w), cos(2w), sin(2w) for each pixel column
+  struct ColumnPhasor {
+    float frequency;
+    float cos_w, sin_w, cos_2w, sin_2w;
+  };
+  std::vector<ColumnPhasor> response_columns_;
+  std::vector<std::tuple<float, float>> response_;
+  // Power of every column, then its dB
+  std::vector<float> response_power_;
 
   // UI values
   float slider_height_ = 120;
-  float slider_count_ = 4;
+  float slider_count_ = 6;
 };
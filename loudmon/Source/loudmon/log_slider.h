@@ -57,8 +57,8 @@ class LogSlider : public juce::Component {
     return slider_.getValue();
   }
 
-  void setValue(double value) {
-    slider_.setValue(value);
+  void setValue(double value, NotificationType notification = sendNotificationAsync) {
+    slider_.setValue(value, notification);
   }
 
   void setOnValueChange(std::function<void()> callback) {
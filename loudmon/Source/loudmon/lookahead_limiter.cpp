@@ -0,0 +1,138 @@
+#include "lookahead_limiter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+using Phases = std::array<std::array<float, TruePeakDetector::TapsPerPhase>, TruePeakDetector::Phases>;
+
+// Hann windowed sinc, cut at the original Nyquist and centered so that phase 0 hits the samples:
+//  it is the sample itself, the other phases interpolate
+Phases design_phases() {
+  const double pi = 3.14159265358979323846;
+  constexpr size_t length = TruePeakDetector::TapsPerPhase * TruePeakDetector::Phases;
+  constexpr double center = length / 2.0;
+  Phases phases{};
+  for (size_t n = 0; n < length; n++) {
+    auto t = (static_cast<double>(n) - center) / TruePeakDetector::Phases;
+    auto sinc = t == 0 ? 1.0 : std::sin(pi * t) / (pi * t);
+    auto window = 0.5 + 0.5 * std::cos(pi * (static_cast<double>(n) - center) / center);
+    phases[n % TruePeakDetector::Phases][n / TruePeakDetector::Phases] = static_cast<float>(sinc * window);
+  }
+  return phases;
+}
+
+// Filled at load time, never on the audio thread
+const Phases phases = design_phases();
+
+}
+
+TruePeakDetector::TruePeakDetector() {
+  reset();
+}
+
+void TruePeakDetector::reset() {
+  history_.fill(0);
+  position_ = 0;
+}
+
+float TruePeakDetector::push(float x) {
+  // Written twice, so that the last TapsPerPhase samples are always contiguous
+  history_[position_] = history_[position_ + TapsPerPhase] = x;
+  position_ = (position_ + 1) % TapsPerPhase;
+  auto recent = &history_[position_];
+  auto peak = 0.0f;
+  for (auto &phase : phases) {
+    float sum = 0;
+    for (size_t tap = 0; tap < TapsPerPhase; tap++) {
+      sum += phase[tap] * recent[TapsPerPhase - 1 - tap];
+    }
+    peak = std::max(peak, std::abs(sum));
+  }
+  return peak;
+}
+
+void LookaheadLimiter::prepare(double sample_rate, size_t channels, float lookahead_seconds, float release_seconds) {
+  lookahead_ = std::max<size_t>(static_cast<size_t>(std::lround(lookahead_seconds * sample_rate)), 1);
+  // A detector's estimate is late, so the audio waits for it as well. Each of the gains averaged
+  //  for a sample has seen the estimates on both sides of it, so the average is below all of them.
+  delay_ = lookahead_ + TruePeakDetector::Delay;
+  window_ = lookahead_ + 2;
+  release_ = static_cast<float>(1 - std::exp(-1 / (release_seconds * sample_rate)));
+  detectors_.assign(channels, {});
+  delay_lines_.assign(channels, std::vector<double>(delay_, 0));
+  candidates_.assign(window_ + 1, {0, 0});
+  requested_.assign(lookahead_, 1);
+  reset();
+}
+
+void LookaheadLimiter::reset() {
+  for (auto &detector : detectors_) {
+    detector.reset();
+  }
+  for (auto &line : delay_lines_) {
+    std::fill(line.begin(), line.end(), 0.0);
+  }
+  delay_position_ = 0;
+  head_ = count_ = 0;
+  sample_index_ = 0;
+  std::fill(requested_.begin(), requested_.end(), 1.0f);
+  requested_position_ = 0;
+  requested_sum_ = static_cast<double>(requested_.size());
+  gain_ = 1;
+}
+
+float LookaheadLimiter::push_peak(float peak) {
+  auto capacity = candidates_.size();
+  // Older candidates that are not larger can never be the maximum again
+  while (count_ > 0 && candidates_[(head_ + count_ - 1) % capacity].peak <= peak) {
+    count_--;
+  }
+  candidates_[(head_ + count_) % capacity] = {sample_index_, peak};
+  count_++;
+  if (sample_index_ - candidates_[head_].index >= window_) {
+    head_ = (head_ + 1) % capacity;
+    count_--;
+  }
+  sample_index_++;
+  return candidates_[head_].peak;
+}
+
+float LookaheadLimiter::process(float *const *channels, size_t channel_count, size_t num_samples) {
+  return process_samples(channels, channel_count, num_samples);
+}
+
+float LookaheadLimiter::process(double *const *channels, size_t channel_count, size_t num_samples) {
+  return process_samples(channels, channel_count, num_samples);
+}
+
+template <typename T>
+float LookaheadLimiter::process_samples(T *const *channels, size_t channel_count, size_t num_samples) {
+  channel_count = std::min(channel_count, detectors_.size());
+  auto lowest_gain = 1.0f;
+  for (size_t i = 0; i < num_samples; i++) {
+    float peak = 0;
+    for (size_t channel = 0; channel < channel_count; channel++) {
+      peak = std::max(peak, detectors_[channel].push(static_cast<float>(channels[channel][i])));
+    }
+    auto upcoming = push_peak(peak);
+    auto requested = upcoming > ceiling_ ? ceiling_ / upcoming : 1.0f;
+    requested_sum_ += requested - requested_[requested_position_];
+    requested_[requested_position_] = requested;
+    requested_position_ = (requested_position_ + 1) % requested_.size();
+    auto target = static_cast<float>(requested_sum_ / static_cast<double>(requested_.size()));
+    // Down at once, the look-ahead already smoothed it, up slowly
+    gain_ = target < gain_ ? target : gain_ + (target - gain_) * release_;
+    lowest_gain = std::min(lowest_gain, gain_);
+
+    for (size_t channel = 0; channel < channel_count; channel++) {
+      auto &line = delay_lines_[channel];
+      auto delayed = line[delay_position_];
+      line[delay_position_] = channels[channel][i];
+      channels[channel][i] = static_cast<T>(delayed * gain_);
+    }
+    delay_position_ = (delay_position_ + 1) % delay_;
+  }
+  return lowest_gain;
+}
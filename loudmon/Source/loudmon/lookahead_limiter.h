@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Estimates inter-sample peaks by 4x oversampling with a windowed sinc, as BS.1770 true-peak meters
+//  do. The estimate for a sample comes out Delay samples after it.
+class TruePeakDetector {
+ public:
+  static constexpr size_t TapsPerPhase = 12;
+  static constexpr size_t Delay = TapsPerPhase / 2;
+  static constexpr size_t Phases = 4;
+
+  TruePeakDetector();
+  void reset();
+  // Largest magnitude of the sample Delay samples ago and the points between it and the next one
+  float push(float x);
+
+ private:
+  std::array<float, TapsPerPhase * 2> history_{};
+  size_t position_ = 0;
+};
+
+/* Keeps the true peak below a ceiling. Audio is delayed by the look-ahead, so the gain can come
+ *  down before a peak arrives: the largest upcoming peak comes from a sliding window maximum over a
+ *  monotonic deque, O(1) per sample, and the gain it asks for is averaged over the look-ahead so it
+ *  ramps instead of stepping. Releases exponentially. Channels share the gain, the image stays put.
+ *  Everything is allocated in prepare. */
+class LookaheadLimiter {
+ public:
+  void prepare(double sample_rate, size_t channels, float lookahead_seconds, float release_seconds);
+  void reset();
+  // Samples the output is late
+  size_t latency() const {
+    return delay_;
+  }
+  void set_ceiling(float linear) {
+    ceiling_ = linear;
+  }
+
+  /* Audio thread */
+  // In place. Returns the lowest gain applied, for metering.
+  float process(float *const *channels, size_t channel_count, size_t num_samples);
+  float process(double *const *channels, size_t channel_count, size_t num_samples);
+
+ private:
+  template <typename T>
+  float process_samples(T *const *channels, size_t channel_count, size_t num_samples);
+  // Maximum of the last window_ values pushed
+  float push_peak(float peak);
+
+ private:
+  float ceiling_ = 1;
+  float release_ = 0;
+  size_t lookahead_ = 0;
+  size_t delay_ = 0;
+  size_t window_ = 0;
+
+  std::vector<TruePeakDetector> detectors_;
+  // [channel][delay_ samples], double so that double blocks come out as they went in
+  std::vector<std::vector<double>> delay_lines_;
+  size_t delay_position_ = 0;
+
+  // Ring of (sample index, peak), peaks decreasing from head to tail
+  struct Candidate {
+    size_t index;
+    float peak;
+  };
+  std::vector<Candidate> candidates_;
+  size_t head_ = 0, count_ = 0;
+  size_t sample_index_ = 0;
+
+  // Moving average of the requested gain over the look-ahead
+  std::vector<float> requested_;
+  size_t requested_position_ = 0;
+  double requested_sum_ = 0;
+  float gain_ = 1;
+};
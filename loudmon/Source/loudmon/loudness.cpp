@@ -0,0 +1,157 @@
+#include "loudness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include "utils.h"
+
+namespace {
+
+// The K-weighting shelf and high-pass at any sample rate, bilinear transforms of the analog filters
+//  that BS.1770 specifies by their 48kHz coefficients
+SeriesCoefficients k_weighting(double sample_rate) {
+  const double pi = 3.14159265358979323846;
+  SeriesCoefficients coefficients;
+
+  auto k = std::tan(pi * 1681.974450955533 / sample_rate);
+  auto q = 0.7071752369554196;
+  auto vh = std::pow(10.0, 3.999843853973347 / 20);
+  auto vb = std::pow(vh, 0.4996667741545416);
+  auto a0 = 1 + k / q + k * k;
+  coefficients.bands[0] = {static_cast<float>((vh + vb * k / q + k * k) / a0),
+                           static_cast<float>(2 * (k * k - vh) / a0),
+                           static_cast<float>((vh - vb * k / q + k * k) / a0),
+                           static_cast<float>(2 * (k * k - 1) / a0),
+                           static_cast<float>((1 - k / q + k * k) / a0)};
+
+  k = std::tan(pi * 38.13547087602444 / sample_rate);
+  q = 0.5003270373238773;
+  a0 = 1 + k / q + k * k;
+  coefficients.bands[1] = {1, -2, 1,
+                           static_cast<float>(2 * (k * k - 1) / a0),
+                           static_cast<float>((1 - k / q + k * k) / a0)};
+  coefficients.active_mask = 0x3;
+  return coefficients;
+}
+
+}
+
+void LoudnessMeter::prepare(double sample_rate, size_t channels, size_t max_block) {
+  weighting_.prepare(channels, max_block);
+  weighting_.set_coefficients_now(k_weighting(sample_rate));
+  scratch_.assign(channels, std::vector<float>(max_block, 0));
+  scratch_pointers_.clear();
+  for (auto &channel : scratch_) {
+    scratch_pointers_.push_back(channel.data());
+  }
+  max_block_ = max_block;
+  step_size_ = std::max<size_t>(static_cast<size_t>(std::lround(sample_rate / 10)), 1);
+  step_energies_.assign(WindowSteps, 0);
+  reset();
+}
+
+void LoudnessMeter::reset() {
+  weighting_.reset();
+  step_fill_ = 0;
+  step_energy_ = 0;
+  std::fill(step_energies_.begin(), step_energies_.end(), 0.0);
+  step_position_ = 0;
+  short_term_ = LoudnessFloor;
+}
+
+bool LoudnessMeter::process(const float *const *channels, size_t channel_count, size_t num_samples) {
+  return process_samples(channels, channel_count, num_samples);
+}
+
+bool LoudnessMeter::process(const double *const *channels, size_t channel_count, size_t num_samples) {
+  return process_samples(channels, channel_count, num_samples);
+}
+
+template <typename T>
+bool LoudnessMeter::process_samples(const T *const *channels, size_t channel_count, size_t num_samples) {
+  channel_count = std::min(channel_count, scratch_.size());
+  auto changed = false;
+  for (size_t done = 0; done < num_samples;) {
+    auto count = std::min({num_samples - done, max_block_, step_size_ - step_fill_});
+    for (size_t channel = 0; channel < channel_count; channel++) {
+      auto input = channels[channel] + done;
+      auto weighted = scratch_[channel].data();
+      for (size_t i = 0; i < count; i++) {
+        weighted[i] = static_cast<float>(input[i]);
+      }
+    }
+    weighting_.process(scratch_pointers_.data(), channel_count, count);
+    for (size_t channel = 0; channel < channel_count; channel++) {
+      auto weighted = scratch_[channel].data();
+      for (size_t i = 0; i < count; i++) {
+        step_energy_ += weighted[i] * weighted[i];
+      }
+    }
+    step_fill_ += count;
+    done += count;
+
+    if (step_fill_ == step_size_) {
+      step_energies_[step_position_] = step_energy_;
+      step_position_ = (step_position_ + 1) % WindowSteps;
+      step_energy_ = 0;
+      step_fill_ = 0;
+      // Summed again instead of kept as a running sum, which would drift
+      auto energy = std::accumulate(step_energies_.begin(), step_energies_.end(), 0.0);
+      auto mean = energy / static_cast<double>(step_size_ * WindowSteps);
+      short_term_ = mean > 0 ? std::max(LoudnessFloor, static_cast<float>(-0.691 + 10 * std::log10(mean))) : LoudnessFloor;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void LoudnessNormalizer::prepare(double sample_rate, size_t channels, size_t max_block) {
+  meter_.prepare(sample_rate, channels, max_block);
+  limiter_.prepare(sample_rate, channels, 0.005f, 0.1f);
+  // -1dBTP, what streaming services ask for
+  limiter_.set_ceiling(std::pow(10.0f, -1.0f / 20));
+  smoothing_ = static_cast<float>(1 - std::exp(-1 / (0.5 * sample_rate)));
+  gain_ = target_gain_ = 1;
+  processed_enabled_ = false;
+  latency_ = limiter_.latency();
+}
+
+void LoudnessNormalizer::process(float *const *channels, size_t channel_count, size_t num_samples) {
+  process_samples(channels, channel_count, num_samples);
+}
+
+void LoudnessNormalizer::process(double *const *channels, size_t channel_count, size_t num_samples) {
+  process_samples(channels, channel_count, num_samples);
+}
+
+template <typename T>
+void LoudnessNormalizer::process_samples(T *const *channels, size_t channel_count, size_t num_samples) {
+  if (meter_.process(channels, channel_count, num_samples)) {
+    short_term_loudness_ = meter_.short_term();
+  }
+  auto enabled = is_enabled();
+  if (enabled != processed_enabled_) {
+    // Starts from unity and glides, the limiter's delay line would otherwise replay old audio
+    processed_enabled_ = enabled;
+    limiter_.reset();
+    gain_ = 1;
+  }
+  if (!enabled) {
+    return;
+  }
+
+  auto loudness = meter_.short_term();
+  if (loudness > GateLufs) {
+    auto gain_db = clip(target() - loudness, MaxCutDb, MaxBoostDb);
+    target_gain_ = std::pow(10.0f, gain_db / 20);
+  }
+  for (size_t i = 0; i < num_samples; i++) {
+    gain_ += (target_gain_ - gain_) * smoothing_;
+    for (size_t channel = 0; channel < channel_count; channel++) {
+      channels[channel][i] *= static_cast<T>(gain_);
+    }
+  }
+  auto limiter_gain = limiter_.process(channels, channel_count, num_samples);
+  gain_db_ = 20 * std::log10(gain_);
+  limiter_gain_db_ = 20 * std::log10(limiter_gain);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include "filter_series.h"
+#include "lookahead_limiter.h"
+
+// Loudness of silence, and of anything quieter
+constexpr float LoudnessFloor = -100;
+
+/* Short-term loudness after ITU-R BS.1770: the K-weighted mean square of the last 3s, summed over
+ *  channels, updated every 100ms. All channels are weighted 1, as left, right and center are. */
+class LoudnessMeter {
+ public:
+  void prepare(double sample_rate, size_t channels, size_t max_block);
+  void reset();
+  // Returns whether short_term() changed
+  bool process(const float *const *channels, size_t channel_count, size_t num_samples);
+  bool process(const double *const *channels, size_t channel_count, size_t num_samples);
+  // LUFS
+  float short_term() const {
+    return short_term_;
+  }
+
+ private:
+  template <typename T>
+  bool process_samples(const T *const *channels, size_t channel_count, size_t num_samples);
+
+  static constexpr size_t WindowSteps = 30;
+  // Shelf and high-pass of the K-weighting
+  FilterSeries<float> weighting_;
+  // [channel][sample], the weighting runs on a copy, in float whatever the input
+  std::vector<std::vector<float>> scratch_;
+  std::vector<float *> scratch_pointers_;
+  size_t max_block_ = 0;
+
+  size_t step_size_ = 0;
+  size_t step_fill_ = 0;
+  double step_energy_ = 0;
+  std::vector<double> step_energies_;
+  size_t step_position_ = 0;
+  float short_term_ = LoudnessFloor;
+};
+
+/* Drives the signal towards a target loudness: the gain follows the short-term loudness of the
+ *  input, slowly, then a look-ahead limiter keeps the true peak under the ceiling. Parameters are set
+ *  from any thread, the audio thread picks them up at the next block. Allocation free after prepare. */
+class LoudnessNormalizer {
+ public:
+  // Not concurrently with process
+  void prepare(double sample_rate, size_t channels, size_t max_block);
+
+  void set_enabled(bool enabled) {
+    enabled_ = enabled;
+  }
+  bool is_enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+  // LUFS
+  void set_target(float target) {
+    target_ = target;
+  }
+  float target() const {
+    return target_.load(std::memory_order_relaxed);
+  }
+  // Delay of the output while enabled, for the host to compensate
+  size_t latency_samples() const {
+    return latency_.load(std::memory_order_relaxed);
+  }
+
+  /* Readings for display, from any thread */
+  float short_term_loudness() const {
+    return short_term_loudness_.load(std::memory_order_relaxed);
+  }
+  float gain_db() const {
+    return gain_db_.load(std::memory_order_relaxed);
+  }
+  // Lowest limiter gain of the last block
+  float limiter_gain_db() const {
+    return limiter_gain_db_.load(std::memory_order_relaxed);
+  }
+
+  /* Audio thread */
+  // Measures all the time, changes the signal only while enabled
+  void process(float *const *channels, size_t channel_count, size_t num_samples);
+  void process(double *const *channels, size_t channel_count, size_t num_samples);
+
+ private:
+  template <typename T>
+  void process_samples(T *const *channels, size_t channel_count, size_t num_samples);
+
+  static constexpr float MaxBoostDb = 12;
+  static constexpr float MaxCutDb = -24;
+  // Below this the input is taken for silence, and the gain holds
+  static constexpr float GateLufs = -70;
+
+  LoudnessMeter meter_;
+  LookaheadLimiter limiter_;
+  // Per sample smoothing of the linear gain
+  float smoothing_ = 0;
+  float gain_ = 1;
+  float target_gain_ = 1;
+  bool processed_enabled_ = false;
+
+  std::atomic<bool> enabled_ = false;
+  std::atomic<float> target_ = -23;
+  std::atomic<size_t> latency_ = 0;
+  std::atomic<float> short_term_loudness_ = LoudnessFloor;
+  std::atomic<float> gain_db_ = 0;
+  std::atomic<float> limiter_gain_db_ = 0;
+};
@@ -0,0 +1,278 @@
+#include "main_filter.h"
+
+#include <functional>
+#include "utils.h"
+
+// Samples the convolver takes in at a time, and so its part of the latency
+constexpr size_t LinearPhasePartitionSize = 256;
+
+MainFilter::MainFilter() {
+  // Spread the spare bands over the spectrum, so that enabling one does something audible
+  for (size_t band = 2; band < BandCount; band++) {
+    bands_[band].frequency = 20.0f * std::pow(1000.0f, static_cast<float>(band - 2) / static_cast<float>(BandCount - 3));
+  }
+  set_band_pair(frequency_, quality_);
+  kernel_worker_ = std::thread(std::bind(&MainFilter::kernel_thread, this));
+}
+
+MainFilter::~MainFilter() {
+  {
+    std::unique_lock<std::mutex> _(kernel_request_lock_);
+    quit_ = true;
+  }
+  kernel_cv_.notify_all();
+  kernel_worker_.join();
+}
+
+void MainFilter::prepare(double sample_rate, size_t channels, size_t max_block) {
+  std::unique_lock<std::mutex> build_lock(kernel_build_lock_);
+  std::unique_lock<std::mutex> lock(writer_lock_);
+  sample_rate_ = sample_rate;
+  // At least 1/12 s at any sample rate, which resolves the bands down to about 50Hz
+  kernel_length_ = clip<size_t>(static_cast<size_t>(nextPowerOfTwo(static_cast<int>(sample_rate / 12))), 1024, 16384);
+  kernel_spectrum_.assign(kernel_length_ * 2, 0);
+  kernel_.assign(kernel_length_, 0);
+  convolver_.prepare(channels, LinearPhasePartitionSize, kernel_length_);
+  dirty_ = ~0u;
+  float_path_.series.prepare(channels, max_block);
+  float_path_.svf.assign(channels, {});
+  double_path_.series.prepare(channels, max_block);
+  double_path_.svf.assign(channels, {});
+  convolver_buffers_.assign(channels, std::vector<float>(max_block, 0));
+  convolver_pointers_.clear();
+  for (auto &buffer : convolver_buffers_) {
+    convolver_pointers_.push_back(buffer.data());
+  }
+  max_block_ = max_block;
+  sample_rate_for_audio_ = static_cast<float>(sample_rate);
+  svf_g_ = prewarp(svf_frequency_ / static_cast<float>(sample_rate));
+  // No ramp from coefficients of another sample rate
+  auto coefficients = update_coefficients();
+  float_path_.series.set_coefficients_now(coefficients);
+  double_path_.series.set_coefficients_now(coefficients);
+  publish(coefficients);
+  convolver_.reset();
+  build_kernel(coefficients);
+}
+
+MainFilter::Coefficients MainFilter::set_parameters(float frequency, float quality) {
+  std::unique_lock<std::mutex> _(writer_lock_);
+  frequency_ = frequency;
+  quality_ = quality;
+  svf_frequency_ = frequency;
+  svf_quality_ = quality;
+  set_band_pair(frequency, quality);
+  publish(update_coefficients());
+  request_kernel();
+  return displayed_coefficients();
+}
+
+void MainFilter::set_band_pair(float frequency, float quality) {
+  bands_[0] = {BandType::HighPass, frequency * 0.9f, quality, 0, true};
+  bands_[1] = {BandType::LowPass, frequency * 1.1f, quality, 0, true};
+  dirty_ |= 0x3;
+}
+
+float MainFilter::frequency() const {
+  std::unique_lock<std::mutex> _(writer_lock_);
+  return frequency_;
+}
+
+float MainFilter::quality() const {
+  std::unique_lock<std::mutex> _(writer_lock_);
+  return quality_;
+}
+
+MainFilter::Coefficients MainFilter::set_band(size_t band, const BandParameters &parameters) {
+  std::unique_lock<std::mutex> _(writer_lock_);
+  jassert(band < BandCount);
+  bands_[band] = parameters;
+  dirty_ |= 1u << band;
+  publish(update_coefficients());
+  request_kernel();
+  return displayed_coefficients();
+}
+
+BandParameters MainFilter::band(size_t band) const {
+  std::unique_lock<std::mutex> _(writer_lock_);
+  return bands_[band];
+}
+
+MainFilter::Coefficients MainFilter::coefficients() const {
+  std::unique_lock<std::mutex> _(writer_lock_);
+  return displayed_coefficients();
+}
+
+MainFilter::Coefficients MainFilter::displayed_coefficients() const {
+  if (mode() == ModeEqualizer) {
+    return designed_;
+  }
+  // The TPT band-pass is the bilinear transform of the analog one, prewarped at the cutoff, which
+  //  is exactly what the RBJ band-pass is
+  Coefficients coefficients;
+  coefficients.bands[0] = design_band({BandType::BandPass, frequency_, quality_, 0, true}, sample_rate_);
+  coefficients.active_mask = 1;
+  return coefficients;
+}
+
+MainFilter::Coefficients MainFilter::update_coefficients() {
+  for (size_t band = 0; band < BandCount; band++) {
+    if ((dirty_ >> band) & 1u) {
+      designed_.bands[band] = design_band(bands_[band], sample_rate_);
+    }
+    if (bands_[band].enabled) {
+      designed_.active_mask |= 1u << band;
+    } else {
+      designed_.active_mask &= ~(1u << band);
+    }
+  }
+  dirty_ = 0;
+  return designed_;
+}
+
+void MainFilter::publish(const Coefficients &coefficients) {
+  coefficients_.back() = coefficients;
+  coefficients_.publish();
+}
+
+void MainFilter::set_mode(Mode mode) {
+  mode_ = mode;
+  // Kernels are only kept up to date while they are used
+  request_kernel();
+}
+
+size_t MainFilter::latency_samples() const {
+  if (mode() != ModeLinearPhase) {
+    return 0;
+  }
+  std::unique_lock<std::mutex> _(writer_lock_);
+  return convolver_.latency() + kernel_length_ / 2;
+}
+
+void MainFilter::request_kernel() {
+  if (mode() != ModeLinearPhase) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> _(kernel_request_lock_);
+    kernel_requested_ = true;
+  }
+  kernel_cv_.notify_one();
+}
+
+void MainFilter::kernel_thread() {
+  std::unique_lock<std::mutex> lock(kernel_request_lock_);
+  while (true) {
+    kernel_cv_.wait(lock, [this]() { return quit_ || kernel_requested_; });
+    if (quit_) {
+      return;
+    }
+    // Requests made during the build are coalesced into one more build
+    kernel_requested_ = false;
+    lock.unlock();
+    {
+      std::unique_lock<std::mutex> build_lock(kernel_build_lock_);
+      Coefficients coefficients;
+      {
+        std::unique_lock<std::mutex> _(writer_lock_);
+        coefficients = designed_;
+      }
+      // Nothing to build for before the first prepare
+      if (kernel_length_ > 0) {
+        build_kernel(coefficients);
+      }
+    }
+    lock.lock();
+  }
+}
+
+void MainFilter::build_kernel(const Coefficients &coefficients) {
+  // Zero phase magnitude response on the FFT grid, delayed by half the kernel through the phase:
+  //  e^(-jw N/2) is (-1)^bin. The inverse transform is then symmetric around N/2, so linear phase.
+  auto bins = kernel_length_ / 2 + 1;
+  std::fill(kernel_spectrum_.begin(), kernel_spectrum_.end(), 0.0f);
+  for (size_t bin = 0; bin < bins; bin++) {
+    auto w = 2 * MathConstants<double>::pi * static_cast<double>(bin) / static_cast<double>(kernel_length_);
+    auto cos_w = static_cast<float>(std::cos(w)), sin_w = static_cast<float>(std::sin(w));
+    auto cos_2w = static_cast<float>(std::cos(2 * w)), sin_2w = static_cast<float>(std::sin(2 * w));
+    float power = 1;
+    for (size_t band = 0; band < BandCount; band++) {
+      if (coefficients.is_active(band)) {
+        power *= biquad_power(coefficients.bands[band], cos_w, sin_w, cos_2w, sin_2w);
+      }
+    }
+    kernel_spectrum_[bin * 2] = (bin & 1u ? -1.0f : 1.0f) * std::sqrt(power);
+  }
+  dsp::FFT(static_cast<int>(std::log2(kernel_length_))).performRealOnlyInverseTransform(kernel_spectrum_.data());
+  // Blackman window, the truncation would otherwise ripple in the stop bands
+  for (size_t i = 0; i < kernel_length_; i++) {
+    auto phase = 2 * MathConstants<double>::pi * static_cast<double>(i) / static_cast<double>(kernel_length_);
+    auto window = 0.42 - 0.5 * std::cos(phase) + 0.08 * std::cos(2 * phase);
+    kernel_[i] = kernel_spectrum_[i] * static_cast<float>(window);
+  }
+  convolver_.set_kernel(kernel_.data(), kernel_.size());
+}
+
+void MainFilter::process(float *const *channels, size_t channel_count, size_t num_samples) {
+  process_samples(channels, channel_count, num_samples);
+}
+
+void MainFilter::process(double *const *channels, size_t channel_count, size_t num_samples) {
+  process_samples(channels, channel_count, num_samples);
+}
+
+template <typename T>
+void MainFilter::process_samples(T *const *channels, size_t channel_count, size_t num_samples) {
+  if (coefficients_.acquire()) {
+    float_path_.series.set_coefficients(coefficients_.front());
+    double_path_.series.set_coefficients(coefficients_.front());
+  }
+  auto mode = mode_.load(std::memory_order_relaxed);
+  if (mode != processed_mode_) {
+    // The other mode's state is stale, start it from silence
+    processed_mode_ = mode;
+    float_path_.series.reset();
+    double_path_.series.reset();
+    convolver_.reset();
+    for (auto &svf : float_path_.svf) {
+      svf.reset();
+    }
+    for (auto &svf : double_path_.svf) {
+      svf.reset();
+    }
+  }
+  auto &filters = path<T>();
+  if (mode == ModeEqualizer) {
+    filters.series.process(channels, channel_count, num_samples);
+    return;
+  }
+  if (mode == ModeLinearPhase) {
+    convolve(channels, channel_count, num_samples);
+    return;
+  }
+
+  auto g = prewarp(svf_frequency_.load(std::memory_order_relaxed) / sample_rate_for_audio_.load(std::memory_order_relaxed));
+  auto k = 1.0f / svf_quality_.load(std::memory_order_relaxed);
+  channel_count = std::min(channel_count, filters.svf.size());
+  for (size_t channel = 0; channel < channel_count; channel++) {
+    filters.svf[channel].process_band_pass(channels[channel], num_samples, static_cast<T>(svf_g_), static_cast<T>(g), static_cast<T>(k));
+  }
+  svf_g_ = g;
+}
+
+void MainFilter::convolve(double *const *channels, size_t channel_count, size_t num_samples) {
+  channel_count = std::min(channel_count, convolver_buffers_.size());
+  for (size_t done = 0; done < num_samples;) {
+    auto count = std::min(num_samples - done, max_block_);
+    for (size_t channel = 0; channel < channel_count; channel++) {
+      for (size_t i = 0; i < count; i++) {
+        convolver_pointers_[channel][i] = static_cast<float>(channels[channel][done + i]);
+      }
+    }
+    convolver_.process(convolver_pointers_.data(), channel_count, count);
+    for (size_t channel = 0; channel < channel_count; channel++) {
+      std::copy(convolver_pointers_[channel], convolver_pointers_[channel] + count, channels[channel] + done);
+    }
+    done += count;
+  }
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "filter_series.h"
+#include "partitioned_convolver.h"
+#include "tpt_svf.h"
+#include "../common/triple_buffer.h"
+
+// The parametric EQ on the main output, FilterSeriesMaxBands bands. By default only the first two
+//  run, as a band filter: a high-pass slightly below and a low-pass slightly above a center
+//  frequency. The others are switched on and tuned from the band controls of the filter view.
+//  Parameters are set from any thread but the audio thread, which picks up the new
+//  coefficients at the next block and ramps to them over that block, so it never waits and sweeps
+//  do not click.
+//  In state variable mode a single TPT band-pass at the center frequency replaces the EQ. Its cutoff
+//  glides every sample and a change costs a table lookup, so automation sweeps it without clicks.
+//  In linear phase mode the EQ's magnitude response runs as a symmetric FIR kernel instead, built on
+//  a worker whenever the bands change. It delays the output by latency_samples().
+class MainFilter {
+ public:
+  using Coefficients = SeriesCoefficients;
+  static constexpr size_t BandCount = FilterSeriesMaxBands;
+  enum Mode {
+    ModeEqualizer,
+    ModeStateVariable,
+    ModeLinearPhase,
+  };
+
+  MainFilter();
+  ~MainFilter();
+
+  /* Not on the audio thread */
+  // Resets the filter state, must not overlap with process
+  void prepare(double sample_rate, size_t channels, size_t max_block);
+  // Tunes the band filter of the first two bands and the state variable band-pass. Returns the
+  //  coefficients for display, as coefficients() does.
+  Coefficients set_parameters(float frequency, float quality);
+  float frequency() const;
+  float quality() const;
+  // Bands 0 and 1 are overwritten by set_parameters. Only the coefficients of bands that changed
+  //  are calculated again.
+  Coefficients set_band(size_t band, const BandParameters &parameters);
+  BandParameters band(size_t band) const;
+  // The coefficients the audio thread will use, for display. In state variable mode, the
+  //  band-pass it is equivalent to.
+  Coefficients coefficients() const;
+
+  void set_enabled(bool enabled) {
+    enabled_ = enabled;
+  }
+  bool is_enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+  void set_mode(Mode mode);
+  Mode mode() const {
+    return mode_.load(std::memory_order_relaxed);
+  }
+  // Delay of the output in the current mode, for the host to compensate
+  size_t latency_samples() const;
+
+  /* Audio thread */
+  void process(float *const *channels, size_t channel_count, size_t num_samples);
+  void process(double *const *channels, size_t channel_count, size_t num_samples);
+
+ private:
+  void set_band_pair(float frequency, float quality);
+  Coefficients update_coefficients();
+  void publish(const Coefficients &coefficients);
+  Coefficients displayed_coefficients() const;
+  // Wakes the kernel worker if the linear phase kernel is out of date
+  void request_kernel();
+  void kernel_thread();
+  // Designs the linear phase kernel and hands it to the convolver, under kernel_build_lock_
+  void build_kernel(const Coefficients &coefficients);
+
+  // The filters of one sample type. Hosts pick the precision, only one of them runs.
+  template <typename T>
+  struct Path {
+    FilterSeries<T> series;
+    std::vector<TptSvf<T>> svf;
+  };
+  template <typename T>
+  Path<T> &path() {
+    if constexpr (std::is_same_v<T, double>) {
+      return double_path_;
+    } else {
+      return float_path_;
+    }
+  }
+  template <typename T>
+  void process_samples(T *const *channels, size_t channel_count, size_t num_samples);
+  void convolve(float *const *channels, size_t channel_count, size_t num_samples) {
+    convolver_.process(channels, channel_count, num_samples);
+  }
+  // juce::dsp::FFT is float only, double blocks are converted around it
+  void convolve(double *const *channels, size_t channel_count, size_t num_samples);
+
+  // Written under writer_lock_, the audio thread only reads
+  TripleBuffer<Coefficients> coefficients_;
+
+  // Writers, serialized by writer_lock_
+  mutable std::mutex writer_lock_;
+  double sample_rate_ = 44100;
+  float frequency_ = std::sqrt(20 * 20000.0f), quality_ = 1.0f;
+  std::array<BandParameters, BandCount> bands_;
+  Coefficients designed_;
+  // Bands whose coefficients are out of date
+  uint32_t dirty_ = ~0u;
+  size_t kernel_length_ = 0;
+
+  // Held while a kernel is built, and by prepare so that it never reallocates under a build
+  std::mutex kernel_build_lock_;
+  std::vector<float> kernel_spectrum_, kernel_;
+  // Only guards the request flags
+  std::mutex kernel_request_lock_;
+  std::condition_variable kernel_cv_;
+  bool kernel_requested_ = false;
+  bool quit_ = false;
+  std::thread kernel_worker_;
+
+  // Audio thread
+  Path<float> float_path_;
+  Path<double> double_path_;
+  PartitionedConvolver convolver_;
+  std::vector<std::vector<float>> convolver_buffers_;
+  std::vector<float *> convolver_pointers_;
+  size_t max_block_ = 0;
+  Mode processed_mode_ = ModeEqualizer;
+  // Prewarped cutoff at the end of the last block, the next block glides from there
+  float svf_g_ = 0;
+
+  // The state variable band-pass reads these directly, they are cheap to apply
+  std::atomic<float> svf_frequency_ = std::sqrt(20 * 20000.0f), svf_quality_ = 1.0f;
+  std::atomic<float> sample_rate_for_audio_ = 44100;
+  std::atomic<Mode> mode_ = ModeEqualizer;
+
+  std::atomic<bool> enabled_ = false;
+};
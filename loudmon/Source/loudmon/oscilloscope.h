@@ -3,6 +3,7 @@
 #include <JuceHeader.h>
 #include "plot.h"
 #include "log_slider.h"
+#include "../common/meter_kernels.h"
 
 class OscilloscopeComponent :public juce::Component {
  public:
@@ -32,13 +33,24 @@ class OscilloscopeComponent :public juce::Component {
     plot_.set_value_range(0, x_value, -y_value, y_value, false, false);
   }
 
-  // non-owning
-  void add_values(const float *ptr, size_t size) {
+  // non-owning. Above 1, every decimation samples are drawn as one line from their minimum to their
+  //  maximum, peaks stay visible.
+  void add_values(const float *ptr, size_t size, size_t decimation = 1) {
     std::unique_lock<spinlock> _(lock_);
     plot_.clear();
-    std::vector<std::tuple<float, float>> values(size);
-    for (size_t i = 0; i < size; i++) {
-      values[i] = {static_cast<float>(i), ptr[i]};
+    std::vector<std::tuple<float, float>> values;
+    if (decimation <= 1) {
+      values.resize(size);
+      for (size_t i = 0; i < size; i++) {
+        values[i] = {static_cast<float>(i), ptr[i]};
+      }
+    } else {
+      values.reserve((size / decimation + 1) * 2);
+      for (size_t i = 0; i < size; i += decimation) {
+        auto range = meter_kernels().min_max(ptr + i, std::min(decimation, size - i));
+        values.emplace_back(static_cast<float>(i), range.min);
+        values.emplace_back(static_cast<float>(i), range.max);
+      }
     }
     plot_.add_new_values("osc", values);
   }
@@ -0,0 +1,163 @@
+#include "partitioned_convolver.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// y += x * h over split complex arrays, plain enough for the compiler to vectorize
+void multiply_accumulate(const float *x_re, const float *x_im, const float *h_re, const float *h_im,
+                         float *y_re, float *y_im, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    y_re[i] += x_re[i] * h_re[i] - x_im[i] * h_im[i];
+    y_im[i] += x_re[i] * h_im[i] + x_im[i] * h_re[i];
+  }
+}
+
+}
+
+void PartitionedConvolver::prepare(size_t channels, size_t partition_size, size_t max_kernel_length) {
+  jassert(isPowerOfTwo(partition_size));
+  partition_size_ = partition_size;
+  bins_ = partition_size + 1;
+  max_partitions_ = std::max<size_t>((max_kernel_length + partition_size - 1) / partition_size, 1);
+  auto order = static_cast<int>(std::log2(partition_size * 2));
+  fft_ = std::make_unique<dsp::FFT>(order);
+  writer_fft_ = std::make_unique<dsp::FFT>(order);
+  fft_buffer_.assign(partition_size * 4, 0);
+  writer_buffer_.assign(partition_size * 4, 0);
+
+  auto allocate = [this](Spectra &spectra) {
+    spectra.re.assign(max_partitions_ * bins_, 0);
+    spectra.im.assign(max_partitions_ * bins_, 0);
+    spectra.partitions = 0;
+  };
+  for (size_t slot = 0; slot < TripleBuffer<Spectra>::SlotCount; slot++) {
+    allocate(kernels_.slot(slot));
+  }
+  allocate(current_kernel_);
+  channels_.resize(channels);
+  for (auto &channel : channels_) {
+    channel.input.assign(partition_size * 2, 0);
+    channel.output.assign(partition_size, 0);
+    allocate(channel.delay_line);
+  }
+  sum_re_.assign(bins_, 0);
+  sum_im_.assign(bins_, 0);
+  fade_re_.assign(bins_, 0);
+  fade_im_.assign(bins_, 0);
+  fade_in_.resize(partition_size);
+  for (size_t i = 0; i < partition_size; i++) {
+    fade_in_[i] = (static_cast<float>(i) + 0.5f) / static_cast<float>(partition_size);
+  }
+  reset();
+}
+
+void PartitionedConvolver::set_kernel(const float *kernel, size_t length) {
+  auto &spectra = kernels_.back();
+  spectra.partitions = std::min((length + partition_size_ - 1) / partition_size_, max_partitions_);
+  for (size_t partition = 0; partition < spectra.partitions; partition++) {
+    // Zero padded to the transform size, so that the products are linear and not circular convolutions
+    std::fill(writer_buffer_.begin(), writer_buffer_.end(), 0.0f);
+    auto begin = partition * partition_size_;
+    auto end = std::min(begin + partition_size_, length);
+    std::copy(kernel + begin, kernel + end, writer_buffer_.begin());
+    writer_fft_->performRealOnlyForwardTransform(writer_buffer_.data(), true);
+    auto re = &spectra.re[partition * bins_], im = &spectra.im[partition * bins_];
+    for (size_t bin = 0; bin < bins_; bin++) {
+      re[bin] = writer_buffer_[bin * 2];
+      im[bin] = writer_buffer_[bin * 2 + 1];
+    }
+  }
+  kernels_.publish();
+}
+
+void PartitionedConvolver::reset() {
+  fill_ = 0;
+  delay_line_position_ = 0;
+  for (auto &channel : channels_) {
+    std::fill(channel.input.begin(), channel.input.end(), 0.0f);
+    std::fill(channel.output.begin(), channel.output.end(), 0.0f);
+    std::fill(channel.delay_line.re.begin(), channel.delay_line.re.end(), 0.0f);
+    std::fill(channel.delay_line.im.begin(), channel.delay_line.im.end(), 0.0f);
+  }
+}
+
+void PartitionedConvolver::process(float *const *channels, size_t channel_count, size_t num_samples) {
+  channel_count = std::min(channel_count, channels_.size());
+  for (size_t done = 0; done < num_samples;) {
+    // Samples go in as they come, and the block computed one partition ago goes out
+    auto count = std::min(num_samples - done, partition_size_ - fill_);
+    for (size_t channel = 0; channel < channel_count; channel++) {
+      auto &state = channels_[channel];
+      auto data = channels[channel] + done;
+      std::copy(data, data + count, state.input.begin() + static_cast<std::ptrdiff_t>(partition_size_ + fill_));
+      std::copy(state.output.begin() + static_cast<std::ptrdiff_t>(fill_),
+                state.output.begin() + static_cast<std::ptrdiff_t>(fill_ + count), data);
+    }
+    fill_ += count;
+    done += count;
+
+    if (fill_ == partition_size_) {
+      auto crossfade = kernels_.acquire();
+      delay_line_position_ = (delay_line_position_ + 1) % max_partitions_;
+      for (size_t channel = 0; channel < channel_count; channel++) {
+        process_partition(channels_[channel], crossfade);
+      }
+      if (crossfade) {
+        auto &kernel = kernels_.front();
+        std::copy(kernel.re.begin(), kernel.re.end(), current_kernel_.re.begin());
+        std::copy(kernel.im.begin(), kernel.im.end(), current_kernel_.im.begin());
+        current_kernel_.partitions = kernel.partitions;
+      }
+      fill_ = 0;
+    }
+  }
+}
+
+void PartitionedConvolver::process_partition(Channel &channel, bool crossfade) {
+  std::copy(channel.input.begin(), channel.input.end(), fft_buffer_.begin());
+  fft_->performRealOnlyForwardTransform(fft_buffer_.data(), true);
+  auto offset = delay_line_position_ * bins_;
+  for (size_t bin = 0; bin < bins_; bin++) {
+    channel.delay_line.re[offset + bin] = fft_buffer_[bin * 2];
+    channel.delay_line.im[offset + bin] = fft_buffer_[bin * 2 + 1];
+  }
+  // Overlap-save: the newest block becomes the older half of the next transform
+  std::copy(channel.input.begin() + static_cast<std::ptrdiff_t>(partition_size_), channel.input.end(), channel.input.begin());
+
+  // The first half of the inverse transform is wrapped around and discarded
+  auto valid = fft_buffer_.begin() + static_cast<std::ptrdiff_t>(partition_size_);
+  accumulate(channel, current_kernel_, sum_re_, sum_im_);
+  inverse_transform(sum_re_, sum_im_);
+  std::copy(valid, valid + static_cast<std::ptrdiff_t>(partition_size_), channel.output.begin());
+  if (!crossfade) {
+    return;
+  }
+  accumulate(channel, kernels_.front(), fade_re_, fade_im_);
+  inverse_transform(fade_re_, fade_im_);
+  for (size_t i = 0; i < partition_size_; i++) {
+    channel.output[i] += fade_in_[i] * (valid[static_cast<std::ptrdiff_t>(i)] - channel.output[i]);
+  }
+}
+
+void PartitionedConvolver::accumulate(const Channel &channel, const Spectra &kernel, std::vector<float> &re, std::vector<float> &im) const {
+  std::fill(re.begin(), re.end(), 0.0f);
+  std::fill(im.begin(), im.end(), 0.0f);
+  for (size_t partition = 0; partition < kernel.partitions; partition++) {
+    // Partition p of the kernel meets the input block from p blocks ago
+    auto slot = (delay_line_position_ + max_partitions_ - partition) % max_partitions_;
+    multiply_accumulate(&channel.delay_line.re[slot * bins_], &channel.delay_line.im[slot * bins_],
+                        &kernel.re[partition * bins_], &kernel.im[partition * bins_],
+                        re.data(), im.data(), bins_);
+  }
+}
+
+void PartitionedConvolver::inverse_transform(const std::vector<float> &re, const std::vector<float> &im) {
+  for (size_t bin = 0; bin < bins_; bin++) {
+    fft_buffer_[bin * 2] = re[bin];
+    fft_buffer_[bin * 2 + 1] = im[bin];
+  }
+  // Scales by 1 / size, so the product of two forward transforms comes back at unity gain
+  fft_->performRealOnlyInverseTransform(fft_buffer_.data());
+}
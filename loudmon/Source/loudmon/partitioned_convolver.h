@@ -0,0 +1,73 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <memory>
+#include <vector>
+#include "../common/triple_buffer.h"
+
+/* Uniformly partitioned overlap-save convolution. The kernel is cut into K partitions of B samples,
+ *  each transformed once with a 2B point FFT. Every B input samples then cost one forward and one
+ *  inverse FFT, plus multiply-accumulating the spectra of the last K input blocks (the frequency
+ *  domain delay line) with the K kernel spectra. The output is B samples late, whatever the kernel.
+ *  Channels share the kernel. */
+class PartitionedConvolver {
+ public:
+  /* Not concurrently with anything else */
+  // partition_size is a power of two. Allocates for kernels of up to max_kernel_length samples.
+  void prepare(size_t channels, size_t partition_size, size_t max_kernel_length);
+  size_t latency() const {
+    return partition_size_;
+  }
+
+  /* Writer, one thread at a time, never the audio thread */
+  // Transforms the kernel and hands it to the audio thread, which crossfades to it over one
+  //  partition. Kernels longer than max_kernel_length are truncated. Does not allocate.
+  void set_kernel(const float *kernel, size_t length);
+
+  /* Audio thread */
+  void reset();
+  void process(float *const *channels, size_t channel_count, size_t num_samples);
+
+ private:
+  // [partition][bin], split into real and imaginary parts so that the products vectorize
+  struct Spectra {
+    std::vector<float> re, im;
+    size_t partitions = 0;
+  };
+  struct Channel {
+    // The last two input blocks, the newest one being filled
+    std::vector<float> input;
+    // The block being played, computed when the input block before it was complete
+    std::vector<float> output;
+    Spectra delay_line;
+  };
+  void process_partition(Channel &channel, bool crossfade);
+  void accumulate(const Channel &channel, const Spectra &kernel, std::vector<float> &re, std::vector<float> &im) const;
+  // result = IFFT(re, im), the last partition_size_ samples are valid
+  void inverse_transform(const std::vector<float> &re, const std::vector<float> &im);
+
+ private:
+  size_t partition_size_ = 0;
+  size_t bins_ = 0;
+  size_t max_partitions_ = 0;
+
+  // Written by set_kernel, the audio thread copies every new kernel into current_kernel_, so that
+  //  the one it fades out from is not in a slot the writer may reuse.
+  TripleBuffer<Spectra> kernels_;
+  std::unique_ptr<dsp::FFT> writer_fft_;
+  std::vector<float> writer_buffer_;
+
+  /* Audio thread */
+  std::unique_ptr<dsp::FFT> fft_;
+  std::vector<Channel> channels_;
+  Spectra current_kernel_;
+  // Samples of the current block that are already in, the same for every channel
+  size_t fill_ = 0;
+  // Delay line slot of the newest input block
+  size_t delay_line_position_ = 0;
+  // 4B floats, as the real-only transforms want
+  std::vector<float> fft_buffer_;
+  std::vector<float> sum_re_, sum_im_, fade_re_, fade_im_;
+  std::vector<float> fade_in_;
+};
@@ -67,6 +67,16 @@ class PlotComponent :public juce::Component {
     reset();
   }
 
+  // x values at the pixel columns of the plot area, so that curves can be evaluated exactly where
+  //  they are drawn instead of being interpolated. Changes when the component is resized.
+  std::vector<float> pixel_column_x_values() const {
+    std::vector<float> values;
+    for (auto x = app_x_min; x < app_x_max; x += 1) {
+      values.push_back(std::get<0>(map_point_reverse(x, app_y_min)));
+    }
+    return values;
+  }
+
   // UI Callbacks in UI thread
   void resized() override {
     left = 0;
@@ -117,7 +127,7 @@ class PlotComponent :public juce::Component {
         y_axis_log_ ? map_value_log(y, y_min_, y_max_, app_y_max, app_y_min /* y is reversed */) : map_value_linear(y, y_min_, y_max_, app_y_max, app_y_min),
     };
   };
-  std::tuple<float, float> map_point_reverse(float x, float y) {
+  std::tuple<float, float> map_point_reverse(float x, float y) const {
     return {
         x_axis_log_ ? map_value_exp(x, app_x_min, app_x_max, x_min_, x_max_) : map_value_linear(x, app_x_min, app_x_max, x_min_, x_max_),
         y_axis_log_ ? map_value_exp(y, app_y_min, app_y_max, y_max_, y_min_ /* y is reversed */) : map_value_linear(y, app_y_min, app_y_max, y_max_, y_min_),
@@ -142,7 +152,7 @@ class PlotComponent :public juce::Component {
   float dot_radius = 4;
   float legend_height = 8;
 
-  float left, top, width, height;
+  float left = 0, top = 0, width = 0, height = 0;
   float app_x_min, app_x_max, app_y_min, app_y_max;
 
   bool x_axis_log_ = false;
@@ -0,0 +1,34 @@
+#include "tpt_svf.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+// Cutoffs up to 0.49 of the sample rate, tan() is too steep above to be worth tabulating
+constexpr size_t PrewarpTableSize = 4096;
+constexpr float PrewarpMaxFrequency = 0.49f;
+
+struct PrewarpTable {
+  PrewarpTable() {
+    const double pi = 3.14159265358979323846;
+    for (size_t i = 0; i < values.size(); i++) {
+      values[i] = static_cast<float>(std::tan(pi * PrewarpMaxFrequency * static_cast<double>(i) / PrewarpTableSize));
+    }
+  }
+  // One extra entry, so that interpolation never reads past the end
+  std::array<float, PrewarpTableSize + 1> values;
+};
+
+// Filled at load time, never on the audio thread
+const PrewarpTable table;
+
+}
+
+float prewarp(float normalized_frequency) {
+  auto position = std::clamp(normalized_frequency / PrewarpMaxFrequency, 0.0f, 1.0f) * PrewarpTableSize;
+  auto index = std::min(static_cast<size_t>(position), PrewarpTableSize - 1);
+  auto frac = position - static_cast<float>(index);
+  return table.values[index] + frac * (table.values[index + 1] - table.values[index]);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+
+// tan(pi * f) for f = cutoff / sample_rate in [0, 0.5), from a table. This is the bilinear
+//  prewarp of a cutoff, so moving a cutoff costs a lookup instead of a tan().
+float prewarp(float normalized_frequency);
+
+/* Topology-preserving transform state variable filter (trapezoidal integrators, after Zavalishin).
+ * The state are the integrators themselves instead of past outputs, so the cutoff and resonance may
+ * change every sample without the transients a direct form biquad produces under modulation. */
+template <typename T>
+class TptSvf {
+ public:
+  struct Outputs {
+    T low, band, high;
+  };
+
+  void reset() {
+    ic1_ = ic2_ = 0;
+  }
+
+  // g is prewarp(cutoff / sample_rate), k is 1 / Q
+  Outputs process(T x, T g, T k) {
+    auto a1 = T(1) / (T(1) + g * (g + k));
+    auto a2 = g * a1;
+    auto a3 = g * a2;
+    auto v3 = x - ic2_;
+    auto v1 = a1 * ic1_ + a2 * v3;
+    auto v2 = ic2_ + a2 * ic1_ + a3 * v3;
+    ic1_ = 2 * v1 - ic1_;
+    ic2_ = 2 * v2 - ic2_;
+    return {v2, v1, x - k * v1 - v2};
+  }
+
+  // Band-pass with 0 dB at the cutoff, in place, with the cutoff ramping linearly from g_from to g_to
+  void process_band_pass(T *data, size_t num_samples, T g_from, T g_to, T k) {
+    auto g = g_from;
+    auto g_step = num_samples > 0 ? (g_to - g_from) / static_cast<T>(num_samples) : T(0);
+    for (size_t i = 0; i < num_samples; i++) {
+      g += g_step;
+      data[i] = k * process(data[i], g, k).band;
+    }
+  }
+
+ private:
+  T ic1_ = 0, ic2_ = 0;
+};
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <atomic>
+#include <utility>
 
 std::string compact_value_text(double f);
 
@@ -31,3 +32,14 @@ T clip(T value, T min, T max) {
     return value;
   }
 }
+
+template <typename F, size_t... Index>
+void unroll(F &&f, std::index_sequence<Index...>) {
+  (f(Index), ...);
+}
+
+// f(channel) for every one of Channels channels, unrolled
+template <size_t Channels, typename F>
+void for_each_channel(F &&f) {
+  unroll(f, std::make_index_sequence<Channels>());
+}
@@ -0,0 +1,35 @@
+#include "keyboard_midi_queue.h"
+
+#include <algorithm>
+#include <cstring>
+
+KeyboardMidiQueue::KeyboardMidiQueue(size_t capacity) :events_(capacity) {
+}
+
+void KeyboardMidiQueue::handleNoteOn(MidiKeyboardState*, int midi_channel, int midi_note_number, float velocity) {
+  push(MidiMessage::noteOn(midi_channel, midi_note_number, velocity));
+}
+
+void KeyboardMidiQueue::handleNoteOff(MidiKeyboardState*, int midi_channel, int midi_note_number, float velocity) {
+  push(MidiMessage::noteOff(midi_channel, midi_note_number, velocity));
+}
+
+void KeyboardMidiQueue::push(const MidiMessage &message) {
+  Event event;
+  event.size = std::min(message.getRawDataSize(), static_cast<int>(sizeof(event.data)));
+  std::memcpy(event.data, message.getRawData(), static_cast<size_t>(event.size));
+  if (!events_.try_push(std::move(event))) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool KeyboardMidiQueue::drain_into(MidiBuffer &output, int sample_position) {
+  bool any = false;
+  Event event;
+  while (events_.try_pop(event)) {
+    // Events at the same position keep their insertion order
+    output.addEvent(event.data, event.size, sample_position);
+    any = true;
+  }
+  return any;
+}
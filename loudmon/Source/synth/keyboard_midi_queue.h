@@ -0,0 +1,35 @@
+#pragma once
+#include <JuceHeader.h>
+
+#include <atomic>
+#include <cstdint>
+#include "../common/mpmc_queue.h"
+
+// Carries on-screen keyboard events to the audio thread. The keyboard pushes from the message thread
+//  and the audio thread drains once per block, neither side locks or allocates. It lives in the
+//  processor, so it works whether the editor exists or not.
+class KeyboardMidiQueue :public MidiKeyboardStateListener {
+ public:
+  explicit KeyboardMidiQueue(size_t capacity = 256);
+
+  void handleNoteOn(MidiKeyboardState *source, int midi_channel, int midi_note_number, float velocity) override;
+  void handleNoteOff(MidiKeyboardState *source, int midi_channel, int midi_note_number, float velocity) override;
+
+  // Adds all queued events to output at sample_position, in the order they were played.
+  //  Returns whether there were any.
+  bool drain_into(MidiBuffer &output, int sample_position);
+  // Events lost because the audio thread did not drain the queue in time
+  size_t dropped_count() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Event {
+    uint8_t data[3] = {};
+    int size = 0;
+  };
+  void push(const MidiMessage &message);
+
+  BoundedMPMCQueue<Event> events_;
+  std::atomic<size_t> dropped_ = 0;
+};
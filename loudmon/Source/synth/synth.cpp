@@ -1,22 +1,105 @@
 #include "synth.h"
 #include "../loudmon/debug_output.h"
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
 
-SynthControl::SynthControl(float sample_rate) :sample_rate_(sample_rate) {
-  for (size_t i = 0; i < available_waveforms_.size(); i++) {
-    waveform_select_.addItem(std::get<0>(available_waveforms_[i]), (int)i+1);
+SynthParameters::SynthParameters() {
+  request_waveform();
+}
+
+std::vector<std::string> SynthParameters::waveform_names() const {
+  std::vector<std::string> names;
+  for (auto &waveform : available_waveforms_) {
+    names.push_back(std::get<0>(waveform));
+  }
+  return names;
+}
+
+void SynthParameters::select_waveform(size_t index) {
+  if (index < available_waveforms_.size()) {
+    selected_waveform_ = index;
+    request_waveform();
+  }
+}
+
+void SynthParameters::request_waveform() {
+  size_t index = selected_waveform_;
+  {
+    std::unique_lock<std::mutex> _(published_->lock);
+    published_->requested = index;
+  }
+  auto &[name, build] = available_waveforms_[index];
+  std::weak_ptr<PublishedWaveForm> weak_published = published_;
+  // The current waveform keeps playing until the new one is ready
+  WaveTableCache::instance().get(name, build, [weak_published, index](std::shared_ptr<const WaveForm> waveform) {
+    auto published = weak_published.lock();
+    if (!published) {
+      return;
+    }
+    std::unique_lock<std::mutex> _(published->lock);
+    // A later selection wins over a build that finished late
+    if (published->requested == index) {
+      published->publish(std::move(waveform));
+    }
+  });
+}
+
+void SynthParameters::PublishedWaveForm::publish(std::shared_ptr<const WaveForm> next) {
+  if (next == waveform) {
+    return;
+  }
+  auto switch_epoch = epoch.load(std::memory_order_relaxed) + 1;
+  if (waveform) {
+    retired.emplace_back(switch_epoch, std::move(waveform));
+  }
+  waveform = std::move(next);
+  current.store(waveform.get(), std::memory_order_release);
+  epoch.store(switch_epoch, std::memory_order_release);
+  release_retired();
+}
+
+void SynthParameters::PublishedWaveForm::release_retired() {
+  auto seen = acked.load(std::memory_order_acquire);
+  retired.erase(std::remove_if(retired.begin(), retired.end(), [seen](const auto &r) {
+    return r.first <= seen;
+  }), retired.end());
+}
+
+std::shared_ptr<const WaveForm> SynthParameters::waveform() const {
+  std::unique_lock<std::mutex> _(published_->lock);
+  published_->release_retired();
+  return published_->waveform;
+}
+
+void SynthParameters::snapshot(SynthParameterSnapshot &snapshot) const {
+  snapshot.amp = amp.load();
+  snapshot.amp_gain = pow(10.0f, snapshot.amp/10.0f);
+  snapshot.harmonics = harmonics.load();
+  snapshot.harmonic_diff = harmonic_diff.load();
+  snapshot.freq_width = freq_width.load();
+  // The previous block is done with the previous waveform. Once the epoch of a switch is acknowledged,
+  //  current was loaded after it and the waveform it replaced is no longer used.
+  auto epoch = published_->epoch.load(std::memory_order_acquire);
+  snapshot.waveform = published_->current.load(std::memory_order_acquire);
+  published_->acked.store(epoch, std::memory_order_release);
+}
+
+SynthControl::SynthControl(SynthParameters &params) :params_(params) {
+  auto names = params_.waveform_names();
+  for (size_t i = 0; i < names.size(); i++) {
+    waveform_select_.addItem(names[i], (int)i+1);
   }
   waveform_select_.onChange = [this]() {
     auto selected_id = waveform_select_.getSelectedId();
-    if (selected_id && sample_rate_ != 0) {
-      auto id = selected_id-1;
-      waveform_ptr_ = std::get<1>(available_waveforms_[id])();
-      update_waveform();
+    if (selected_id) {
+      params_.select_waveform(static_cast<size_t>(selected_id-1));
     }
   };
-  waveform_select_.setSelectedItemIndex(0, dontSendNotification);
-  waveform_select_.onChange();
+  // Keeps the waveform the processor is already playing
+  waveform_select_.setSelectedItemIndex(static_cast<int>(params_.selected_waveform()), dontSendNotification);
+  update_waveform();
 
   oscilloscope_.set_yx_display_ratio(2 / juce::MathConstants<float>::twoPi);
   addAndMakeVisible(oscilloscope_);
@@ -54,32 +137,11 @@ void SynthControl::add_component(juce::Component *p) {
   components_.push_back(p);
 }
 
-MPESimpleVoice::MPESimpleVoice(std::function<SynthControl* ()> get_control) :get_control_(std::move(get_control)) {
-  ADSR::Parameters params{};
-  params.attack = 0.001f;
-  params.decay = 0.1f;
-  params.sustain = 0.5f;
-  params.release = 0.02f;
-  adsr_.setParameters(params);
+MPESimpleVoice::MPESimpleVoice(const SynthParameterSnapshot *params, VoiceBank *voice_bank, size_t voice_index)
+    :params_(params), voice_bank_(voice_bank), voice_index_(voice_index) {
 }
 
-void MPESimpleVoice::renderNextBlock(AudioBuffer<float> &output_buffer, int startSample, int num_sample) {
-  auto control = get_control_();
-  if (!control) {
-    return;
-  }
-
-  AudioBuffer<float> process_buffer(output_buffer.getNumChannels(), num_sample);
-  process_buffer.clear();
-  render_note(control, process_buffer);
-  adsr_.applyEnvelopeToBuffer(output_buffer, 0, num_sample);
-  if (!adsr_.isActive()) {
-    clear_note();
-  }
-  for (int channel = 0; channel < output_buffer.getNumChannels(); channel++) {
-    output_buffer.addFrom(channel, startSample, process_buffer, channel, 0, num_sample);
-  }
-  sample_pos_ += num_sample;
+void MPESimpleVoice::renderNextBlock(AudioBuffer<float> &, int, int) {
 }
 
 void MPESimpleVoice::noteStarted() {
@@ -87,37 +149,151 @@ void MPESimpleVoice::noteStarted() {
   jassert (currentlyPlayingNote.keyState == MPENote::keyDown
                || currentlyPlayingNote.keyState == MPENote::keyDownAndSustained);
 
-  frequency = static_cast<float>(currentlyPlayingNote.getFrequencyInHertz());
-  sample_pos_ = 0;
-  adsr_.noteOn();
-  auto control = get_control_();
-  if (control && control->waveform()) {
-    waveform_voice_ = control->waveform()->get_voice();
+  auto frequency = static_cast<float>(currentlyPlayingNote.getFrequencyInHertz());
+  PartialLayout layout;
+  layout.harmonics = params_->harmonics;
+  layout.harmonic_diff = params_->harmonic_diff;
+  layout.freq_width = params_->freq_width;
+  voice_bank_->start(voice_index_, params_->waveform, frequency, layout);
+  if (!voice_bank_->is_active(voice_index_)) {
+    clearCurrentNote();
   }
 }
 void MPESimpleVoice::noteStopped(bool allowTailOff) {
   jassert (currentlyPlayingNote.keyState == MPENote::off);
   if (allowTailOff) {
-    adsr_.noteOff();
+    voice_bank_->release(voice_index_);
   } else {
-    clear_note();
+    voice_bank_->stop(voice_index_);
+    clearCurrentNote();
   }
 }
 void MPESimpleVoice::notePressureChanged() {
 }
 void MPESimpleVoice::notePitchbendChanged() {
-  frequency = static_cast<float>(currentlyPlayingNote.getFrequencyInHertz());
+  voice_bank_->set_frequency(voice_index_, static_cast<float>(currentlyPlayingNote.getFrequencyInHertz()));
+}
+
+VoiceBankSynthesiser::VoiceBankSynthesiser(const SynthParameterSnapshot *params, size_t voice_count)
+    :params_(params), voice_bank_(voice_count) {
+  for (size_t i = 0; i != voice_count; ++i) {
+    addVoice(new MPESimpleVoice(params_, &voice_bank_, i));
+  }
 }
 
-void MPESimpleVoice::render_note(SynthControl *control, AudioBuffer<float> &output_buffer) {
-  auto num_samples = output_buffer.getNumSamples();
-  auto amp = pow(10.0f, control->amp.value()/10.0f);
+void VoiceBankSynthesiser::prepare(double sample_rate, int max_block_size) {
+  setCurrentPlaybackSampleRate(sample_rate);
+  voice_bank_.set_sample_rate(static_cast<float>(sample_rate));
+  mix_.assign(static_cast<size_t>(max_block_size), 0.0f);
+  for (auto &buffer : participant_mix_) {
+    buffer.assign(mix_.size(), 0.0f);
+  }
+}
+
+void VoiceBankSynthesiser::set_worker_count(size_t worker_count) {
+  workers_.reset();
+  participant_mix_.clear();
+  active_groups_.clear();
+  if (worker_count == 0) {
+    return;
+  }
+  workers_ = std::make_unique<WorkerGroup>(worker_count);
+  participant_mix_.resize(workers_->participant_count(), std::vector<float>(mix_.size(), 0.0f));
+  active_groups_.reserve(voice_bank_.group_count());
+}
+
+void VoiceBankSynthesiser::renderNextSubBlock(AudioBuffer<float> &output_audio, int start_sample, int num_samples) {
+  render_voices(output_audio, start_sample, num_samples);
+}
+
+void VoiceBankSynthesiser::renderNextSubBlock(AudioBuffer<double> &output_audio, int start_sample, int num_samples) {
+  render_voices(output_audio, start_sample, num_samples);
+}
+
+template <typename T>
+void VoiceBankSynthesiser::render_voices(AudioBuffer<T> &output_audio, int start_sample, int num_samples) {
+  // Hosts may send larger blocks than announced
+  jassert(static_cast<size_t>(num_samples) <= mix_.size());
+  num_samples = std::min(num_samples, static_cast<int>(mix_.size()));
+
+  std::fill(mix_.begin(), mix_.begin() + num_samples, 0.0f);
+  auto t0 = std::chrono::high_resolution_clock::now();
+  render_bank(static_cast<size_t>(num_samples));
+  auto t1 = std::chrono::high_resolution_clock::now();
+  schedule_voices(std::chrono::duration<double>(t1 - t0).count(), num_samples);
+  for (int channel = 0; channel < output_audio.getNumChannels(); channel++) {
+    auto out = output_audio.getWritePointer(channel, start_sample);
+    for (int i = 0; i < num_samples; i++) {
+      out[i] += static_cast<T>(mix_[static_cast<size_t>(i)]);
+    }
+  }
+
+  const ScopedLock sl(voicesLock);
+  for (auto voice : voices) {
+    auto simple_voice = static_cast<MPESimpleVoice*>(voice);
+    if (simple_voice->isActive() && !voice_bank_.is_active(simple_voice->voice_index())) {
+      simple_voice->finish_note();
+    }
+  }
+}
+
+void VoiceBankSynthesiser::render_bank(size_t num_samples) {
+  active_groups_.clear();
+  if (workers_) {
+    for (size_t group = 0; group < voice_bank_.group_count(); group++) {
+      if (voice_bank_.is_group_active(group)) {
+        active_groups_.push_back(group);
+      }
+    }
+  }
+  // A single lane group is not worth waking anyone up
+  if (active_groups_.size() < 2) {
+    voice_bank_.render(mix_.data(), num_samples, params_->amp_gain);
+    return;
+  }
+
+  for (auto &buffer : participant_mix_) {
+    std::fill(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(num_samples), 0.0f);
+  }
+  auto task = [this, num_samples](size_t index, size_t participant) {
+    voice_bank_.render_group(participant_mix_[participant].data(), num_samples, active_groups_[index]);
+  };
+  // Past its share of the block the audio thread stops waiting for workers to pick groups up
+  auto claim_deadline = WorkerGroup::Clock::time_point::max();
+  if (getSampleRate() > 0) {
+    claim_deadline = WorkerGroup::Clock::now() + std::chrono::duration_cast<WorkerGroup::Clock::duration>(
+        std::chrono::duration<double>(cpu_budget_ * static_cast<double>(num_samples) / getSampleRate()));
+  }
+  workers_->run(active_groups_.size(), task, claim_deadline);
+  for (auto &buffer : participant_mix_) {
+    FloatVectorOperations::add(mix_.data(), buffer.data(), static_cast<int>(num_samples));
+  }
+  FloatVectorOperations::multiply(mix_.data(), params_->amp_gain, static_cast<int>(num_samples));
+}
+
+void VoiceBankSynthesiser::schedule_voices(double render_seconds, int num_samples) {
+  budget_render_seconds_ += render_seconds;
+  budget_samples_ += num_samples;
+  if (budget_samples_ < budget_window_ || getSampleRate() <= 0) {
+    return;
+  }
+  auto load = budget_render_seconds_ / (budget_samples_ / getSampleRate());
+  budget_render_seconds_ = 0;
+  budget_samples_ = 0;
+  if (load <= cpu_budget_) {
+    return;
+  }
 
-  if (waveform_voice_) {
-    waveform_voice_->fill_next_samples(frequency, output_buffer.getWritePointer(0), num_samples);
-    juce::FloatVectorOperations::multiply(output_buffer.getWritePointer(0), amp, num_samples);
-    for (int channel = 1; channel < output_buffer.getNumChannels(); channel++) {
-      output_buffer.copyFrom(channel, 0, output_buffer, 0, 0, num_samples);
+  // Cost is about linear in the weight of the voices, shed the weight that is over budget
+  auto weight = voice_bank_.cost_weight();
+  auto target_weight = weight * static_cast<float>(cpu_budget_ / load);
+  while (weight > target_weight) {
+    auto voice = voice_bank_.steal_candidate();
+    if (voice == VoiceBank::NoVoice) {
+      break;
     }
+    weight -= voice_bank_.cost_weight(voice);
+    voice_bank_.fast_release(voice);
+    stolen_voice_count_++;
   }
 }
@@ -1,10 +1,17 @@
 #pragma once
 #include <JuceHeader.h>
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
 #include <type_traits>
+#include <vector>
 #include "../loudmon/log_slider.h"
 #include "../loudmon/oscilloscope.h"
+#include "../common/worker_group.h"
 #include "waveform.h"
+#include "wavetable_cache.h"
+#include "voice_bank.h"
 
 template <typename ValueType>
 class SynthParameterRaw {
@@ -31,12 +38,99 @@ class SynthParameterRaw {
   ValueType min_, max_, interval_, default_value_;
   bool log_scale_;
 };
+// Processor side value of a parameter. Written by the UI, read once per block by the audio thread.
+template <typename ValueType>
+class SynthParameterValue {
+ public:
+  explicit SynthParameterValue(SynthParameterRaw<ValueType> raw)
+      :raw_(std::move(raw)), value_(raw_.default_value()) {
+  }
+  const SynthParameterRaw<ValueType> &raw() const {
+    return raw_;
+  }
+  ValueType load() const {
+    return value_.load(std::memory_order_relaxed);
+  }
+  void store(ValueType value) {
+    value_.store(value, std::memory_order_relaxed);
+  }
+ private:
+  SynthParameterRaw<ValueType> raw_;
+  std::atomic<ValueType> value_;
+};
+
+// Plain copy of all synth parameters, taken once per block and shared by all voices
+struct SynthParameterSnapshot {
+  float amp = 0;
+  // amp converted to a linear gain
+  float amp_gain = 1;
+  int harmonics = 1;
+  int harmonic_diff = 1;
+  int freq_width = 1;
+  // Not released before the audio thread took its next snapshot. Voices keep playing it after
+  //  that, WaveTableCache never frees a table.
+  const WaveForm *waveform = nullptr;
+};
+
+// Owned by the processor, so the synth plays the same with or without an editor
+class SynthParameters {
+ public:
+  SynthParameters();
+
+  SynthParameterValue<float> amp = SynthParameterValue<float>({"Amp(dB)", -50, 10, 0.1f, -15, false});
+  SynthParameterValue<int> harmonics = SynthParameterValue<int>({"Harmonics", 1, 10, 1, 1, false});
+  SynthParameterValue<int> harmonic_diff = SynthParameterValue<int>({"Harmonic Diff", 1, 10, 1, 1, false});
+  SynthParameterValue<int> freq_width = SynthParameterValue<int>({"Frequency Width", 1, 10, 1, 5, false});
+
+  /* Not in the audio thread */
+  std::vector<std::string> waveform_names() const;
+  size_t selected_waveform() const {
+    return selected_waveform_.load();
+  }
+  void select_waveform(size_t index);
+  // nullptr until the first table is ready. Also releases the waveforms the audio thread is done with.
+  std::shared_ptr<const WaveForm> waveform() const;
+
+  /* Audio thread */
+  // Lock-free, the audio thread never owns a waveform
+  void snapshot(SynthParameterSnapshot &snapshot) const;
+
+ private:
+  void request_waveform();
+
+ private:
+  // Shared with background builds, which may finish after the parameters are gone
+  struct PublishedWaveForm {
+    // Under lock
+    void publish(std::shared_ptr<const WaveForm> next);
+    void release_retired();
+
+    std::mutex lock;
+    size_t requested = 0;
+    std::shared_ptr<const WaveForm> waveform;
+    // What the audio thread plays, owned by waveform
+    std::atomic<const WaveForm*> current = nullptr;
+    // Bumped by every switch. The audio thread acknowledges the epoch it read before loading current,
+    //  a replaced waveform is released once the acknowledged epoch reaches the switch that replaced it.
+    std::atomic<uint64_t> epoch = 0;
+    std::atomic<uint64_t> acked = 0;
+    std::vector<std::pair<uint64_t, std::shared_ptr<const WaveForm>>> retired;
+  };
+
+  std::vector<std::tuple<std::string, std::function<std::shared_ptr<WaveForm>()>>> available_waveforms_ = {
+      {"Sine", [](){ return std::make_shared<SineWave>(); }},
+      {"Saw", [](){ return std::make_shared<SawWave>(); }}
+  };
+  std::atomic<size_t> selected_waveform_ = 0;
+  std::shared_ptr<PublishedWaveForm> published_ = std::make_shared<PublishedWaveForm>();
+};
+
 template <typename ValueType, typename ControlType>
 class SynthParameter : public juce::Component {
  public:
   SynthParameter(
       ControlType *ctrl, /*non-owning*/
-      SynthParameterRaw<ValueType> p);
+      SynthParameterValue<ValueType> &value /*non-owning*/);
   void resized() override {
     auto area = getLocalBounds();
     name_label_.setBounds(area.removeFromTop(15));
@@ -47,87 +141,76 @@ class SynthParameter : public juce::Component {
     }
   }
   ValueType value() const {
-    return value_;
+    return value_.load();
   }
  private:
   ControlType *ctrl_;
   Label name_label_;
   std::unique_ptr<Slider> slider_;
   std::unique_ptr<LogSlider> log_slider_;
-  SynthParameterRaw<ValueType> param_;
-  std::atomic<ValueType> value_;
+  const SynthParameterRaw<ValueType> &param_;
+  SynthParameterValue<ValueType> &value_;
 };
 
-#define SYNTH_PARAM(control_type, type, var, display_name, min, max, interval, default_value) \
-  SynthParameter<type, control_type> var = SynthParameter<type, control_type>(this, SynthParameterRaw<type>(display_name, min, max, interval, default_value, false))
-
-#define SYNTH_PARAM_LOG(control_type, type, var, display_name, min, max, interval, default_value) \
-  SynthParameter<type, control_type> var = SynthParameter<type, control_type>(this, SynthParameterRaw<type>(display_name, min, max, interval, default_value, true))
+#define SYNTH_PARAM(control_type, type, var, value) \
+  SynthParameter<type, control_type> var = SynthParameter<type, control_type>(this, value)
 
 
 class SynthControl : public juce::Component {
  public:
-  explicit SynthControl(float sample_rate = 44100.0f);
+  explicit SynthControl(SynthParameters &params);
   void resized() override;
   void add_component(juce::Component *p);
 
+  // Once per UI frame, shows the waveform once its table is ready
   void update_waveform() {
-    if (waveform()) {
-      auto [data, size] = waveform()->get_original_waveform();
+    auto waveform = params_.waveform();
+    if (waveform && waveform.get() != displayed_waveform_) {
+      displayed_waveform_ = waveform.get();
+      auto [data, size] = waveform->get_original_waveform();
       oscilloscope_.add_values(data, size);
       oscilloscope_.set_x_slider_range(0, size);
     }
   }
 
-  void set_sample_rate(float sample_rate) {
-    sample_rate_ = sample_rate;
-  }
-
-  const WaveForm *waveform() {
-    return waveform_ptr_.get();
-  }
  private:
+  SynthParameters &params_;
   // Waveform related
   ComboBox waveform_select_;
   OscilloscopeComponent oscilloscope_;
-  float sample_rate_;
-  std::shared_ptr<WaveForm> waveform_ptr_;
-  std::vector<std::tuple<std::string, std::function<std::unique_ptr<WaveForm>()>>> available_waveforms_ = {
-      {"Sine", [this](){ return std::make_unique<SineWave>(sample_rate_, 256, 12*10, 12*10*8); }},
-      {"Saw", [this](){ return std::make_unique<SawWave>(sample_rate_, 256, 12*10, 12*10*8); }}
-  };
+  const WaveForm *displayed_waveform_ = nullptr;
 
   std::vector<juce::Component*> components_;
  public:
   // These paramaters must be place after components_
-  SYNTH_PARAM(SynthControl, float, amp, "Amp(dB)", -50, 10, 0.1f, -15);
-  SYNTH_PARAM(SynthControl, int, harmonics, "Harmonics", 1, 10, 1, 1);
-  SYNTH_PARAM(SynthControl, int, harmonic_diff, "Harmonic Diff", 1, 10, 1, 1);
-  SYNTH_PARAM(SynthControl, int, freq_width, "Frequency Width", 1, 10, 1, 5);
+  SYNTH_PARAM(SynthControl, float, amp, params_.amp);
+  SYNTH_PARAM(SynthControl, int, harmonics, params_.harmonics);
+  SYNTH_PARAM(SynthControl, int, harmonic_diff, params_.harmonic_diff);
+  SYNTH_PARAM(SynthControl, int, freq_width, params_.freq_width);
 };
 
 template<typename ValueType, typename ControlType>
 SynthParameter<ValueType, ControlType>::SynthParameter(
     ControlType *ctrl,
-    SynthParameterRaw<ValueType> p)
-    :ctrl_(ctrl), param_(std::move(p)) {
+    SynthParameterValue<ValueType> &value)
+    :ctrl_(ctrl), param_(value.raw()), value_(value) {
 
   if (param_.log_scale()) {
     log_slider_ = std::make_unique<LogSlider>();
     log_slider_->setSliderStyle(Slider::SliderStyle::RotaryHorizontalVerticalDrag);
     log_slider_->setRangeLogarithm(static_cast<double>(param_.min()), static_cast<double>(param_.max()));
-    log_slider_->setValue(param_.default_value());
+    log_slider_->setValue(value_.load());
     log_slider_->setOnValueChange([this]() {
-      value_ = static_cast<ValueType>(log_slider_->getValue());
+      value_.store(static_cast<ValueType>(log_slider_->getValue()));
     });
     addAndMakeVisible(*log_slider_);
   } else {
     slider_ = std::make_unique<juce::Slider>();
     slider_->setSliderStyle(Slider::SliderStyle::RotaryHorizontalVerticalDrag);
     slider_->setRange(param_.min(), param_.max(), param_.interval());
-    slider_->setValue(param_.default_value());
+    slider_->setValue(value_.load());
     slider_->onValueChange = [this]() {
-      value_ = static_cast<ValueType>(slider_->getValue());
+      value_.store(static_cast<ValueType>(slider_->getValue()));
     };
     addAndMakeVisible(*slider_);
   }
@@ -139,7 +222,9 @@ SynthParameter<ValueType, ControlType>::SynthParameter(
 
 class MPESimpleVoice  : public MPESynthesiserVoice {
  public:
-  MPESimpleVoice(std::function<SynthControl *()> get_control);
+  // params is owned by the processor and refreshed before every block.
+  //  The voice only tracks its note, the sound is rendered by voice_bank in slot voice_index.
+  MPESimpleVoice(const SynthParameterSnapshot *params, VoiceBank *voice_bank, size_t voice_index);
   void noteStarted() override;
 
   void noteStopped (bool allowTailOff) override;
@@ -151,23 +236,72 @@ class MPESimpleVoice  : public MPESynthesiserVoice {
   void noteTimbreChanged()   override {}
   void noteKeyStateChanged() override {}
 
-  void render_note(SynthControl *control, AudioBuffer<float> &output_buffer);
-
+  // Not used, VoiceBankSynthesiser renders all voices at once
   void renderNextBlock (AudioBuffer<float>& output_buffer,
                         int startSample,
                         int num_sample) override;
 
- private:
-  void clear_note() {
+  size_t voice_index() const {
+    return voice_index_;
+  }
+  // The bank finished the release of this voice
+  void finish_note() {
     clearCurrentNote();
-    waveform_voice_ = nullptr;
   }
 
  private:
-  float frequency;
-  size_t sample_pos_;
-  ADSR adsr_;
-  std::function<SynthControl *()> get_control_;
-  std::unique_ptr<WaveFormVoice> waveform_voice_;
+  const SynthParameterSnapshot *params_;
+  VoiceBank *voice_bank_;
+  size_t voice_index_;
 };
 
+// Renders all its MPESimpleVoice through one VoiceBank instead of voice by voice
+class VoiceBankSynthesiser :public MPESynthesiser {
+ public:
+  VoiceBankSynthesiser(const SynthParameterSnapshot *params, size_t voice_count);
+
+  // Allocates everything rendering needs for blocks up to max_block_size
+  void prepare(double sample_rate, int max_block_size);
+  // Threads that help the audio thread render voices, 0 renders serially. Not while rendering.
+  void set_worker_count(size_t worker_count);
+
+  // Share of real time that rendering the voices may take. Above it, the quietest (then oldest)
+  //  voices are faded out until the measured cost fits again.
+  void set_cpu_budget(float fraction) {
+    cpu_budget_ = fraction;
+  }
+  size_t active_voice_count() const {
+    return voice_bank_.active_voice_count();
+  }
+  // Voices stolen to stay in budget, since start
+  size_t stolen_voice_count() const {
+    return stolen_voice_count_;
+  }
+
+ protected:
+  void renderNextSubBlock(AudioBuffer<float> &output_audio, int start_sample, int num_samples) override;
+  void renderNextSubBlock(AudioBuffer<double> &output_audio, int start_sample, int num_samples) override;
+
+ private:
+  template <typename T>
+  void render_voices(AudioBuffer<T> &output_audio, int start_sample, int num_samples);
+  void render_bank(size_t num_samples);
+  void schedule_voices(double render_seconds, int num_samples);
+
+ private:
+  const SynthParameterSnapshot *params_;
+  VoiceBank voice_bank_;
+  std::vector<float> mix_;
+
+  std::unique_ptr<WorkerGroup> workers_;
+  // One mix buffer per participant of the worker group, summed into mix_ afterwards
+  std::vector<std::vector<float>> participant_mix_;
+  std::vector<size_t> active_groups_;
+
+  float cpu_budget_ = 0.5f;
+  // Sub-blocks can be a few samples long, the cost is measured over at least this many samples
+  const int budget_window_ = 256;
+  double budget_render_seconds_ = 0;
+  int budget_samples_ = 0;
+  size_t stolen_voice_count_ = 0;
+};
@@ -0,0 +1,585 @@
+#include "voice_bank.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+VoiceBank::VoiceBank(size_t max_voices)
+    :voice_count_((max_voices + Lanes - 1) / Lanes * Lanes),
+     phase_(voice_count_, 0.0f),
+     increment_(voice_count_, 0.0f),
+     lower_table_(voice_count_, silence_.data()),
+     lower_size_(voice_count_, 1.0f),
+     upper_table_(voice_count_, silence_.data()),
+     upper_size_(voice_count_, 1.0f),
+     fade_(voice_count_, 0.0f),
+     envelope_value_(voice_count_, 0.0f),
+     envelope_step_(voice_count_, 0.0f),
+     stage_(voice_count_, Idle),
+     stage_samples_left_(voice_count_, std::numeric_limits<int>::max()),
+     release_tail_samples_(voice_count_, 0),
+     waveform_(voice_count_, nullptr),
+     frequency_(voice_count_, 0.0f),
+     additive_(voice_count_, 0),
+     layout_(voice_count_),
+     start_order_(voice_count_, 0),
+     fast_released_(voice_count_, 0),
+     pending_start_(voice_count_, 0),
+     pending_release_(voice_count_, 0),
+     pending_waveform_(voice_count_, nullptr),
+     pending_frequency_(voice_count_, 0.0f),
+     pending_layout_(voice_count_),
+     pending_start_order_(voice_count_, 0),
+     partial_cos_(voice_count_ * MaxPartials, 1.0f),
+     partial_sin_(voice_count_ * MaxPartials, 0.0f),
+     partial_rotation_cos_(voice_count_ * MaxPartials, 1.0f),
+     partial_rotation_sin_(voice_count_ * MaxPartials, 0.0f),
+     partial_amp_(voice_count_ * MaxPartials, 0.0f) {
+  envelope_.attack = 0.001f;
+  envelope_.decay = 0.1f;
+  envelope_.sustain = 0.5f;
+  envelope_.release = 0.02f;
+}
+
+void VoiceBank::set_sample_rate(float sample_rate) {
+  sample_rate_ = sample_rate;
+  for (size_t voice = 0; voice < voice_count_; voice++) {
+    if (is_active(voice)) {
+      set_frequency(voice, pending_start_[voice] ? pending_frequency_[voice] : frequency_[voice]);
+    }
+  }
+}
+
+void VoiceBank::set_envelope(const ADSR::Parameters &params) {
+  envelope_ = params;
+}
+
+void VoiceBank::start(size_t voice, const WaveForm *waveform, float frequency, const PartialLayout &layout) {
+  auto additive = layout.harmonics > 1;
+  if (!additive && !waveform) {
+    stop(voice);
+    return;
+  }
+  auto order = next_start_order_++;
+  if (!is_active(voice) || envelope_value_[voice] == 0) {
+    start_note(voice, waveform, frequency, layout, order);
+    return;
+  }
+  // Resetting the oscillators under a sounding envelope would click
+  pending_start_[voice] = 1;
+  pending_release_[voice] = 0;
+  pending_waveform_[voice] = waveform;
+  pending_frequency_[voice] = frequency;
+  pending_layout_[voice] = layout;
+  pending_start_order_[voice] = order;
+  fast_release(voice);
+}
+
+void VoiceBank::start_note(size_t voice, const WaveForm *waveform, float frequency, const PartialLayout &layout,
+                           uint64_t order) {
+  // Clears both the wavetable and the additive state, only the new mode's is set again
+  enter_stage(voice, Idle);
+  auto additive = layout.harmonics > 1;
+  additive_[voice] = additive;
+  layout_[voice] = layout;
+  start_order_[voice] = order;
+  fast_released_[voice] = 0;
+  waveform_[voice] = additive ? nullptr : waveform;
+  phase_[voice] = 0;
+  for (size_t slot = voice * MaxPartials; slot < (voice + 1) * MaxPartials; slot++) {
+    partial_cos_[slot] = 1;
+    partial_sin_[slot] = 0;
+  }
+  // Stage first, set_frequency renders releasing voices cheaper
+  enter_stage(voice, Attack);
+  set_frequency(voice, frequency);
+}
+
+void VoiceBank::finish_release(size_t voice) {
+  // A note released while the previous one was still fading out is never heard
+  if (!pending_start_[voice] || pending_release_[voice]) {
+    stop(voice);
+    return;
+  }
+  pending_start_[voice] = 0;
+  start_note(voice, pending_waveform_[voice], pending_frequency_[voice], pending_layout_[voice],
+             pending_start_order_[voice]);
+}
+
+void VoiceBank::set_frequency(size_t voice, float frequency) {
+  if (pending_start_[voice]) {
+    pending_frequency_[voice] = frequency;
+    return;
+  }
+  frequency_[voice] = frequency;
+  if (additive_[voice]) {
+    set_partials(voice);
+    return;
+  }
+  if (!waveform_[voice]) {
+    return;
+  }
+  increment_[voice] = frequency / sample_rate_;
+  auto levels = waveform_[voice]->select_levels(increment_[voice]);
+  lower_table_[voice] = levels.lower;
+  lower_size_[voice] = levels.lower_size;
+  upper_table_[voice] = levels.upper;
+  upper_size_[voice] = levels.upper_size;
+  fade_[voice] = levels.fade;
+  if (stage_[voice] == ReleaseTail) {
+    upper_table_[voice] = lower_table_[voice];
+    upper_size_[voice] = lower_size_[voice];
+    fade_[voice] = 0;
+  }
+}
+
+void VoiceBank::set_partials(size_t voice) {
+  auto &layout = layout_[voice];
+  auto count = std::min(static_cast<size_t>(std::max(layout.harmonics, 1)), MaxPartials);
+  auto base = voice * MaxPartials;
+  float amp_sum = 0;
+  for (size_t partial = 0; partial < MaxPartials; partial++) {
+    float amp = 0, step = 0;
+    if (partial < count) {
+      auto side = partial % 2 ? 1.0f : -1.0f;
+      auto detune_cents = side * static_cast<float>(layout.freq_width - 1) * 5.0f * static_cast<float>(partial) / static_cast<float>(count);
+      auto frequency = frequency_[voice] * static_cast<float>(1 + partial * static_cast<size_t>(layout.harmonic_diff)) * std::exp2(detune_cents / 1200.0f);
+      // Partials above Nyquist would alias, they are silenced instead
+      if (frequency < sample_rate_ / 2) {
+        amp = 1.0f / static_cast<float>(partial + 1);
+        step = MathConstants<float>::twoPi * frequency / sample_rate_;
+      }
+    }
+    partial_amp_[base + partial] = stage_[voice] == ReleaseTail && partial >= ReleasePartials ? 0.0f : amp;
+    partial_rotation_cos_[base + partial] = std::cos(step);
+    partial_rotation_sin_[base + partial] = std::sin(step);
+    amp_sum += amp;
+  }
+  // Keeps the peak level of all partials in phase at 1, like the wavetables
+  if (amp_sum > 0) {
+    for (size_t partial = 0; partial < MaxPartials; partial++) {
+      partial_amp_[base + partial] /= amp_sum;
+    }
+  }
+}
+
+void VoiceBank::release(size_t voice) {
+  if (pending_start_[voice]) {
+    pending_release_[voice] = 1;
+  } else if (is_active(voice) && stage_[voice] < Release) {
+    enter_stage(voice, Release);
+  }
+}
+
+void VoiceBank::stop(size_t voice) {
+  pending_start_[voice] = 0;
+  pending_waveform_[voice] = nullptr;
+  enter_stage(voice, Idle);
+}
+
+void VoiceBank::fast_release(size_t voice) {
+  if (!is_active(voice) || fast_released_[voice]) {
+    return;
+  }
+  fast_released_[voice] = 1;
+  auto samples = std::max(1, static_cast<int>(FastReleaseSeconds * sample_rate_));
+  auto release_left = stage_[voice] == Release ? stage_samples_left_[voice] + release_tail_samples_[voice]
+                      : stage_[voice] == ReleaseTail ? stage_samples_left_[voice]
+                      : std::numeric_limits<int>::max();
+  if (samples < release_left) {
+    begin_release(voice, samples);
+  }
+}
+
+void VoiceBank::begin_release(size_t voice, int samples) {
+  stage_[voice] = Release;
+  auto level = envelope_value_[voice];
+  envelope_step_[voice] = -level / static_cast<float>(samples);
+  // Switching to the cheaper rendering changes the timbre, only done once that is inaudible
+  auto full_samples = 0;
+  if (level > CheapReleaseLevel) {
+    full_samples = std::min(samples - 1, static_cast<int>(static_cast<float>(samples) * (level - CheapReleaseLevel) / level));
+  }
+  release_tail_samples_[voice] = samples - full_samples;
+  if (full_samples > 0) {
+    stage_samples_left_[voice] = full_samples;
+  } else {
+    enter_stage(voice, ReleaseTail);
+  }
+}
+
+size_t VoiceBank::active_voice_count() const {
+  size_t count = 0;
+  for (size_t voice = 0; voice < voice_count_; voice++) {
+    count += is_active(voice);
+  }
+  return count;
+}
+
+float VoiceBank::cost_weight(size_t voice) const {
+  if (!is_active(voice) || fast_released_[voice]) {
+    return 0;
+  }
+  if (additive_[voice]) {
+    return static_cast<float>(std::min(static_cast<size_t>(layout_[voice].harmonics), MaxPartials));
+  }
+  return 1;
+}
+
+float VoiceBank::cost_weight() const {
+  float weight = 0;
+  for (size_t voice = 0; voice < voice_count_; voice++) {
+    weight += cost_weight(voice);
+  }
+  return weight;
+}
+
+size_t VoiceBank::steal_candidate() const {
+  auto candidate = NoVoice;
+  for (size_t voice = 0; voice < voice_count_; voice++) {
+    if (!is_active(voice) || fast_released_[voice]) {
+      continue;
+    }
+    if (candidate == NoVoice
+        || envelope_value_[voice] < envelope_value_[candidate]
+        || (envelope_value_[voice] == envelope_value_[candidate] && start_order_[voice] < start_order_[candidate])) {
+      candidate = voice;
+    }
+  }
+  return candidate;
+}
+
+void VoiceBank::enter_stage(size_t voice, Stage stage) {
+  auto samples = [this](float seconds) {
+    return std::max(1, static_cast<int>(seconds * sample_rate_));
+  };
+  stage_[voice] = stage;
+  switch (stage) {
+    case Attack:
+      stage_samples_left_[voice] = samples(envelope_.attack);
+      envelope_step_[voice] = (1.0f - envelope_value_[voice]) / static_cast<float>(stage_samples_left_[voice]);
+      break;
+    case Decay:
+      envelope_value_[voice] = 1.0f;
+      stage_samples_left_[voice] = samples(envelope_.decay);
+      envelope_step_[voice] = (envelope_.sustain - 1.0f) / static_cast<float>(stage_samples_left_[voice]);
+      break;
+    case Sustain:
+      envelope_value_[voice] = envelope_.sustain;
+      stage_samples_left_[voice] = std::numeric_limits<int>::max();
+      envelope_step_[voice] = 0;
+      break;
+    case Release:
+      begin_release(voice, samples(envelope_.release));
+      break;
+    case ReleaseTail:
+      stage_samples_left_[voice] = release_tail_samples_[voice];
+      // Voices render cheaper for the rest of their release: wavetables without the level
+      //  crossfade, additive voices with fewer partials
+      upper_table_[voice] = lower_table_[voice];
+      upper_size_[voice] = lower_size_[voice];
+      fade_[voice] = 0;
+      if (additive_[voice]) {
+        std::fill(partial_amp_.begin() + static_cast<long>(voice * MaxPartials + ReleasePartials),
+                  partial_amp_.begin() + static_cast<long>((voice + 1) * MaxPartials), 0.0f);
+      }
+      break;
+    case Idle:
+      // Idle lanes still run through the loop, reading silence with a zero envelope
+      envelope_value_[voice] = 0;
+      envelope_step_[voice] = 0;
+      stage_samples_left_[voice] = std::numeric_limits<int>::max();
+      increment_[voice] = 0;
+      lower_table_[voice] = upper_table_[voice] = silence_.data();
+      lower_size_[voice] = upper_size_[voice] = 1.0f;
+      waveform_[voice] = nullptr;
+      additive_[voice] = 0;
+      std::fill(partial_amp_.begin() + static_cast<long>(voice * MaxPartials),
+                partial_amp_.begin() + static_cast<long>((voice + 1) * MaxPartials), 0.0f);
+      break;
+  }
+}
+
+void VoiceBank::render(float *output, size_t num_samples, float gain) {
+  for (size_t group = 0; group < group_count(); group++) {
+    if (is_group_active(group)) {
+      render_group(output, num_samples, group);
+    }
+  }
+  if (gain != 1.0f) {
+    FloatVectorOperations::multiply(output, gain, static_cast<int>(num_samples));
+  }
+}
+
+bool VoiceBank::is_group_active(size_t group) const {
+  for (size_t voice = group * Lanes; voice < (group + 1) * Lanes; voice++) {
+    if (is_active(voice)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void VoiceBank::render_group(float *output, size_t num_samples, size_t group) {
+  auto voice_begin = group * Lanes, voice_end = (group + 1) * Lanes;
+  // Envelopes are linear within a stage, so the block is split wherever a voice changes stage
+  //  and the inner loop never has to check for transitions.
+  size_t done = 0;
+  while (done < num_samples) {
+    auto chunk = static_cast<int>(num_samples - done);
+    for (size_t voice = voice_begin; voice < voice_end; voice++) {
+      chunk = std::min(chunk, stage_samples_left_[voice]);
+    }
+    render_partials_chunk(output + done, static_cast<size_t>(chunk), group);
+    render_chunk(output + done, static_cast<size_t>(chunk), group);
+    done += static_cast<size_t>(chunk);
+
+    for (size_t voice = voice_begin; voice < voice_end; voice++) {
+      envelope_value_[voice] += static_cast<float>(chunk) * envelope_step_[voice];
+    }
+    for (size_t voice = voice_begin; voice < voice_end; voice++) {
+      if (stage_[voice] == Idle || stage_[voice] == Sustain) {
+        continue;
+      }
+      stage_samples_left_[voice] -= chunk;
+      if (stage_samples_left_[voice] == 0) {
+        switch (stage_[voice]) {
+          case Attack: enter_stage(voice, Decay); break;
+          case Decay: enter_stage(voice, Sustain); break;
+          case Release: enter_stage(voice, ReleaseTail); break;
+          default: finish_release(voice); break;
+        }
+      }
+    }
+  }
+}
+
+void VoiceBank::render_chunk(float *output, size_t num_samples, size_t group) {
+  for (size_t voice = group * Lanes; voice < (group + 1) * Lanes; voice++) {
+    if (stage_[voice] == Idle || additive_[voice]) {
+      continue;
+    }
+    if (fade_[voice] == 0) {
+      render_voice<false>(output, num_samples, voice);
+    } else {
+      render_voice<true>(output, num_samples, voice);
+    }
+  }
+}
+
+// Phase and envelope are computed from the start of the span instead of accumulated, so samples
+//  do not depend on each other and the loop vectorizes over them, the table reads become gathers.
+//  Separate function so that the pointers are restrict.
+template <bool Crossfade>
+static void render_table_span(float *__restrict output, int count, float phase, float increment,
+                              float envelope, float envelope_step,
+                              const float *__restrict lower, float lower_size,
+                              const float *__restrict upper, float upper_size, float fade) {
+  for (int i = 0; i < count; i++) {
+    auto t = static_cast<float>(i);
+    auto p = phase + t * increment;
+    p -= static_cast<float>(static_cast<int>(p));
+
+    auto lo_pos = p * lower_size;
+    auto lo_index = static_cast<int>(lo_pos);
+    auto lo_frac = lo_pos - static_cast<float>(lo_index);
+    auto value = lower[lo_index] + lo_frac * (lower[lo_index + 1] - lower[lo_index]);
+    if constexpr (Crossfade) {
+      auto hi_pos = p * upper_size;
+      auto hi_index = static_cast<int>(hi_pos);
+      auto hi_frac = hi_pos - static_cast<float>(hi_index);
+      auto hi = upper[hi_index] + hi_frac * (upper[hi_index + 1] - upper[hi_index]);
+      value += fade * (hi - value);
+    }
+    output[i] += value * (envelope + t * envelope_step);
+  }
+}
+
+template <bool Crossfade>
+void VoiceBank::render_voice(float *output, size_t num_samples, size_t voice) {
+  auto phase = phase_[voice], increment = increment_[voice];
+  auto envelope = envelope_value_[voice], envelope_step = envelope_step_[voice];
+  for (size_t done = 0; done < num_samples; done += ClosedFormSamples) {
+    auto count = static_cast<int>(std::min(num_samples - done, ClosedFormSamples));
+    render_table_span<Crossfade>(output + done, count, phase, increment, envelope, envelope_step,
+                                 lower_table_[voice], lower_size_[voice], upper_table_[voice], upper_size_[voice], fade_[voice]);
+    phase += static_cast<float>(count) * increment;
+    phase -= static_cast<float>(static_cast<int>(phase));
+    envelope += static_cast<float>(count) * envelope_step;
+  }
+  phase_[voice] = phase;
+}
+
+void VoiceBank::render_partials_chunk(float *output, size_t num_samples, size_t group) {
+  // The voices of a lane group own Lanes * MaxPartials slots, a whole number of lane groups of partials
+  auto partial_begin = group * Lanes * MaxPartials, partial_end = (group + 1) * Lanes * MaxPartials;
+  for (size_t done = 0; done < num_samples; done += ClosedFormSamples) {
+    auto count = std::min(num_samples - done, ClosedFormSamples);
+    // Lanes are summed across all partials first, one horizontal sum per sample is left at the end
+    float mix[ClosedFormSamples][Lanes];
+    bool audible = false;
+    for (size_t first_slot = partial_begin; first_slot < partial_end; first_slot += Lanes) {
+      float c[Lanes], s[Lanes], rotation_cos[Lanes], rotation_sin[Lanes], amp[Lanes], envelope[Lanes], envelope_step[Lanes];
+      bool slots_audible = false;
+      for (size_t lane = 0; lane < Lanes; lane++) {
+        auto slot = first_slot + lane;
+        auto voice = slot / MaxPartials;
+        c[lane] = partial_cos_[slot];
+        s[lane] = partial_sin_[slot];
+        rotation_cos[lane] = partial_rotation_cos_[slot];
+        rotation_sin[lane] = partial_rotation_sin_[slot];
+        amp[lane] = partial_amp_[slot];
+        envelope_step[lane] = envelope_step_[voice];
+        envelope[lane] = envelope_value_[voice] + static_cast<float>(done) * envelope_step[lane];
+        slots_audible |= amp[lane] != 0;
+      }
+      if (!slots_audible) {
+        continue;
+      }
+      if (!audible) {
+        std::fill(&mix[0][0], &mix[0][0] + count * Lanes, 0.0f);
+        audible = true;
+      }
+
+      for (size_t i = 0; i < count; i++) {
+        for (size_t lane = 0; lane < Lanes; lane++) {
+          mix[i][lane] += s[lane] * amp[lane] * envelope[lane];
+          auto next_c = c[lane] * rotation_cos[lane] - s[lane] * rotation_sin[lane];
+          s[lane] = c[lane] * rotation_sin[lane] + s[lane] * rotation_cos[lane];
+          c[lane] = next_c;
+          envelope[lane] += envelope_step[lane];
+        }
+      }
+
+      for (size_t lane = 0; lane < Lanes; lane++) {
+        // Rounding makes the phasor drift off the unit circle, pulled back once per span
+        auto correction = (3.0f - (c[lane] * c[lane] + s[lane] * s[lane])) / 2.0f;
+        partial_cos_[first_slot + lane] = c[lane] * correction;
+        partial_sin_[first_slot + lane] = s[lane] * correction;
+      }
+    }
+    if (!audible) {
+      continue;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      // Pairwise, so that the halves add as vectors
+      for (size_t width = Lanes / 2; width > 0; width /= 2) {
+        for (size_t lane = 0; lane < width; lane++) {
+          mix[i][lane] += mix[i][lane + width];
+        }
+      }
+      output[done + i] += mix[i][0];
+    }
+  }
+}
+
+#if JUCE_UNIT_TESTS
+class VoiceBankTest : public UnitTest {
+ public:
+  VoiceBankTest() : UnitTest("VoiceBank", "loudmon") {}
+
+  void runTest() override {
+    PartialLayout wavetable, additive;
+    additive.harmonics = 4;
+
+    beginTest("Additive voice stolen by a wavetable note");
+    expect_steal_plays_only_new_note(additive, wavetable);
+    beginTest("Wavetable voice stolen by an additive note");
+    expect_steal_plays_only_new_note(wavetable, additive);
+    beginTest("Wavetable note off keeps the sound");
+    expect_release_keeps_sound(wavetable);
+    beginTest("Additive note off keeps the sound");
+    expect_release_keeps_sound(additive);
+  }
+
+ private:
+  // Until the envelope reaches CheapReleaseLevel a released voice must sound like the held note,
+  //  only fading, so that the note off neither clicks nor changes the timbre
+  void expect_release_keeps_sound(const PartialLayout &layout) {
+    const float sample_rate = 48000;
+    const size_t block = 64;
+    ADSR::Parameters envelope;
+    envelope.attack = 0.001f;
+    envelope.decay = 0.01f;
+    envelope.sustain = 0.5f;
+    envelope.release = 0.02f;
+    auto release_samples = static_cast<size_t>(envelope.release * sample_rate);
+    auto full_samples = static_cast<size_t>(static_cast<float>(release_samples) * (envelope.sustain - VoiceBank::CheapReleaseLevel) / envelope.sustain);
+    auto waveform = std::make_shared<SawWave>();
+
+    VoiceBank released(VoiceBank::Lanes), held(VoiceBank::Lanes);
+    for (auto bank : {&released, &held}) {
+      bank->set_sample_rate(sample_rate);
+      bank->set_envelope(envelope);
+      // Between two table levels, so that the wavetable voice crossfades
+      bank->start(0, waveform.get(), 1234, layout);
+    }
+    std::vector<float> out(release_samples), expected(release_samples);
+    for (int i = 0; i < 20; i++) {
+      released.render(out.data(), block, 1);
+      held.render(expected.data(), block, 1);
+    }
+
+    released.release(0);
+    std::fill(out.begin(), out.end(), 0.0f);
+    std::fill(expected.begin(), expected.end(), 0.0f);
+    for (size_t done = 0; done < release_samples; done += block) {
+      auto count = std::min(block, release_samples - done);
+      released.render(out.data() + done, count, 1);
+      held.render(expected.data() + done, count, 1);
+    }
+    float max_error = 0, peak = 0;
+    for (size_t i = 0; i < full_samples; i++) {
+      auto fade = 1.0f - static_cast<float>(i) / static_cast<float>(release_samples);
+      max_error = std::max(max_error, std::abs(out[i] - expected[i] * fade));
+      peak = std::max(peak, std::abs(out[i]));
+    }
+    expectGreaterThan(peak, 0.1f);
+    expectLessThan(max_error, 1e-4f);
+    expect(!released.is_active(0), "The release outlasts its length");
+  }
+
+  // After the fade out of the stolen note, the voice must sound exactly like the new note started
+  //  on a fresh voice, with nothing left of the previous note's mode
+  void expect_steal_plays_only_new_note(const PartialLayout &old_layout, const PartialLayout &new_layout) {
+    const float sample_rate = 48000;
+    const size_t block = 256;
+    auto fade = static_cast<size_t>(VoiceBank::FastReleaseSeconds * sample_rate);
+    auto waveform = std::make_shared<SawWave>();
+
+    VoiceBank stolen(VoiceBank::Lanes), fresh(VoiceBank::Lanes);
+    stolen.set_sample_rate(sample_rate);
+    fresh.set_sample_rate(sample_rate);
+    std::vector<float> out(block), expected(block);
+    stolen.start(0, waveform.get(), 220, old_layout);
+    for (int i = 0; i < 20; i++) {
+      stolen.render(out.data(), block, 1);
+    }
+
+    stolen.start(0, waveform.get(), 330, new_layout);
+    std::fill(out.begin(), out.end(), 0.0f);
+    stolen.render(out.data(), fade, 1);
+    auto fade_peak = FloatVectorOperations::findMaximum(out.data(), static_cast<int>(fade));
+    expectGreaterThan(fade_peak, 0.0f, "The stolen note is cut instead of faded");
+    expect(stolen.is_active(0));
+
+    fresh.start(0, waveform.get(), 330, new_layout);
+    float max_error = 0, peak = 0;
+    for (int i = 0; i < 20; i++) {
+      std::fill(out.begin(), out.end(), 0.0f);
+      std::fill(expected.begin(), expected.end(), 0.0f);
+      stolen.render(out.data(), block, 1);
+      fresh.render(expected.data(), block, 1);
+      for (size_t j = 0; j < block; j++) {
+        max_error = std::max(max_error, std::abs(out[j] - expected[j]));
+        peak = std::max(peak, std::abs(expected[j]));
+      }
+    }
+    expectGreaterThan(peak, 0.1f);
+    expectLessThan(max_error, 1e-6f);
+  }
+};
+
+static VoiceBankTest voice_bank_test;
+#endif
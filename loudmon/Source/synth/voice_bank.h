@@ -0,0 +1,148 @@
+#pragma once
+#include <JuceHeader.h>
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "waveform.h"
+
+// How a voice spreads its energy over partials, fixed at note start.
+//  A single harmonic plays the wavetable, more harmonics switch the voice to additive synthesis.
+struct PartialLayout {
+  int harmonics = 1;
+  // Partial k is at (1 + k * harmonic_diff) times the fundamental
+  int harmonic_diff = 1;
+  // Detunes partials alternately up and down by up to (freq_width - 1) * 5 cents, widening every line
+  int freq_width = 1;
+};
+
+// Oscillator and envelope state of all voices in structure of arrays form. Wavetable voices are
+//  rendered one at a time with loops over samples that vectorize, additive voices Lanes partials
+//  at a time with loops over lanes that vectorize.
+class VoiceBank {
+ public:
+  static constexpr size_t Lanes = 8;
+  static constexpr size_t MaxPartials = 10;
+  // Partials kept by additive voices at the end of their release
+  static constexpr size_t ReleasePartials = 3;
+  // Envelope level below which releasing voices render cheaper, -40 dB
+  static constexpr float CheapReleaseLevel = 0.01f;
+  // Samples rendered from one starting phase, (ClosedFormSamples * increment) keeps enough precision
+  //  in a float
+  static constexpr size_t ClosedFormSamples = 64;
+
+  explicit VoiceBank(size_t max_voices = 16);
+
+  void set_sample_rate(float sample_rate);
+  void set_envelope(const ADSR::Parameters &params);
+
+  // Length of the fade out of released or stolen voices, to free them without a click
+  static constexpr float FastReleaseSeconds = 0.005f;
+
+  /* Audio thread, voice is the index of the voice in the synthesiser */
+  // A voice that still sounds is stolen: it fades out first and the note starts after the fade.
+  //  The bank does not own waveform, it must outlive the note. The synth's tables come from
+  //  WaveTableCache, which keeps every table it built until the process ends.
+  void start(size_t voice, const WaveForm *waveform, float frequency, const PartialLayout &layout = {});
+  void set_frequency(size_t voice, float frequency);
+  // Starts the release stage, a voice that releases already keeps its release
+  void release(size_t voice);
+  void stop(size_t voice);
+  bool is_active(size_t voice) const {
+    return stage_[voice] != Idle;
+  }
+  // Fades the voice out over FastReleaseSeconds
+  void fast_release(size_t voice);
+
+  /* Voice scheduling, audio thread */
+  static constexpr size_t NoVoice = std::numeric_limits<size_t>::max();
+  size_t active_voice_count() const;
+  // Relative render cost of the voices that are not being fast released, a wavetable voice costs 1
+  float cost_weight() const;
+  float cost_weight(size_t voice) const;
+  // The quietest voice that is not fast released yet, the oldest one among equally quiet voices
+  size_t steal_candidate() const;
+
+  // Adds all active voices multiplied by gain to output
+  void render(float *output, size_t num_samples, float gain);
+
+  /* Lane groups of voices share no state, different groups may render on different threads at once */
+  size_t group_count() const {
+    return voice_count_ / Lanes;
+  }
+  bool is_group_active(size_t group) const;
+  // Adds the voices of one lane group to output, without gain
+  void render_group(float *output, size_t num_samples, size_t group);
+
+ private:
+  enum Stage : int {
+    Idle,
+    Attack,
+    Decay,
+    Sustain,
+    Release,
+    // The rest of the release, below CheapReleaseLevel
+    ReleaseTail,
+  };
+  void enter_stage(size_t voice, Stage stage);
+  // Ramps the envelope to 0 over samples, the part below CheapReleaseLevel in ReleaseTail
+  void begin_release(size_t voice, int samples);
+  // From silence, with no state left from the previous note. order is taken in start, render_group
+  //  starts pending notes on worker threads and must not touch next_start_order_.
+  void start_note(size_t voice, const WaveForm *waveform, float frequency, const PartialLayout &layout,
+                  uint64_t order);
+  // The release reached silence
+  void finish_release(size_t voice);
+  void set_partials(size_t voice);
+  // Neither advances the envelopes, render_group does once both ran
+  void render_chunk(float *output, size_t num_samples, size_t group);
+  template <bool Crossfade>
+  void render_voice(float *output, size_t num_samples, size_t voice);
+  void render_partials_chunk(float *output, size_t num_samples, size_t group);
+
+ private:
+  size_t voice_count_;
+  float sample_rate_ = 44100;
+  ADSR::Parameters envelope_;
+  // Table of voices without a wavetable, so that no voice ever points to a released one
+  std::vector<float> silence_ = std::vector<float>(2, 0.0f);
+
+  /* Per voice, padded to a multiple of Lanes */
+  std::vector<float> phase_;
+  std::vector<float> increment_;
+  std::vector<const float*> lower_table_;
+  std::vector<float> lower_size_;
+  std::vector<const float*> upper_table_;
+  std::vector<float> upper_size_;
+  std::vector<float> fade_;
+  std::vector<float> envelope_value_;
+  std::vector<float> envelope_step_;
+  std::vector<int> stage_;
+  // Until the next stage transition
+  std::vector<int> stage_samples_left_;
+  // Length of ReleaseTail, set when the release starts
+  std::vector<int> release_tail_samples_;
+  std::vector<const WaveForm*> waveform_;
+  std::vector<float> frequency_;
+  std::vector<int> additive_;
+  std::vector<PartialLayout> layout_;
+  // Order of the note on events, the oldest note is stolen first
+  std::vector<uint64_t> start_order_;
+  uint64_t next_start_order_ = 0;
+  std::vector<int> fast_released_;
+  // Note of a stolen voice, started once the previous one faded out
+  std::vector<int> pending_start_;
+  std::vector<int> pending_release_;
+  std::vector<const WaveForm*> pending_waveform_;
+  std::vector<float> pending_frequency_;
+  std::vector<PartialLayout> pending_layout_;
+  std::vector<uint64_t> pending_start_order_;
+
+  /* Per partial, MaxPartials slots per voice. Every partial is a recursive oscillator, a unit phasor
+   *  (cos, sin) rotated by the partial's angular step each sample. */
+  std::vector<float> partial_cos_;
+  std::vector<float> partial_sin_;
+  std::vector<float> partial_rotation_cos_;
+  std::vector<float> partial_rotation_sin_;
+  std::vector<float> partial_amp_;
+};
@@ -2,96 +2,80 @@
 
 #include <cassert>
 
-WaveForm::WaveForm(AudioBuffer<float> data, float original_freq, size_t freqs_per_octave, size_t resample_cache_size)
-    :original_samples_(std::move(data)),
-     original_frequency_(original_freq),
-     freqs_per_octave_(freqs_per_octave),
-     resample_cache_size_(resample_cache_size) {
-  setup_resample_cache();
+WaveForm::WaveForm(const AudioBuffer<float> &single_cycle) {
+  build_levels(single_cycle);
 }
 
-size_t WaveForm::memory_size() const {
-  size_t ret = 0;
-  for (auto &cache : resample_cache_) {
-    ret += cache.getNumSamples() * sizeof(float);
-  }
-  ret += sizeof(*this);
-  return ret;
-}
-size_t WaveForm::get_index(float frequency) const {
-  auto ratio = frequency / min_frequency_;
-  if (ratio <= 1) {
-    return 0;
-  } else {
-    auto index = size_t(round(log2(ratio) * freqs_per_octave_));
-    return std::min(index, resample_cache_size_-1);
-  }
-}
+void WaveForm::build_levels(const AudioBuffer<float> &single_cycle) {
+  assert(single_cycle.getNumSamples() == WaveTableSize);
+  // Real only transforms need twice the size
+  std::vector<float> spectrum(WaveTableSize * 2, 0.0f);
+  std::copy(single_cycle.getReadPointer(0), single_cycle.getReadPointer(0) + WaveTableSize, spectrum.begin());
+  dsp::FFT(static_cast<int>(std::log2(WaveTableSize))).performRealOnlyForwardTransform(spectrum.data(), true);
 
-float WaveForm::get_frequency(size_t index) const {
-  return exp2(float(index)/freqs_per_octave_) * min_frequency_;
-}
+  std::vector<float> level_spectrum;
+  for (size_t level = 0; level < WaveTableLevels; level++) {
+    auto harmonics = (WaveTableSize / 4) >> level;
+    auto size = std::max(WaveTableSize >> level, WaveTableMinSize);
+    // Bins above the kept harmonics are zero, so an inverse transform of the smaller size
+    //  resamples the cycle without aliasing. The inverse transform scales by 1/size.
+    level_spectrum.assign(size * 2, 0.0f);
+    auto scale = static_cast<float>(size) / WaveTableSize;
+    for (size_t bin = 1; bin <= harmonics; bin++) {
+      level_spectrum[bin * 2] = spectrum[bin * 2] * scale;
+      level_spectrum[bin * 2 + 1] = spectrum[bin * 2 + 1] * scale;
+    }
+    level_spectrum[0] = spectrum[0] * scale;
+    dsp::FFT(static_cast<int>(std::log2(size))).performRealOnlyInverseTransform(level_spectrum.data());
 
-void WaveForm::setup_resample_cache() {
-  for (size_t i = 0; i < resample_cache_size_; i++) {
-    auto target_freq = get_frequency(i);
-    double speed_ratio = target_freq / original_frequency_;
-    auto target_sample_count = static_cast<int>(ceil(original_samples_.getNumSamples() / speed_ratio));
-    auto &buf = resample_cache_.emplace_back(1, target_sample_count);
-    interpolator_.reset();
-    interpolator_.process(speed_ratio, original_samples_.getReadPointer(0), buf.getWritePointer(0), target_sample_count);
+    auto &l = levels_[level];
+    l.size = size;
+    l.table.assign(level_spectrum.begin(), level_spectrum.begin() + static_cast<long>(size));
+    l.table.push_back(l.table[0]);
   }
 }
 
-std::tuple<const float *, size_t> WaveForm::get_original_waveform() const {
-  return {original_samples_.getReadPointer(0), original_samples_.getNumSamples()};
-}
-std::unique_ptr<WaveFormVoice> WaveForm::get_voice() const {
-  return std::make_unique<WaveFormVoice>(weak_from_this());
-}
-
-float WaveFormVoice::next_sample(float frequency) {
-  auto parent = parent_.lock();
-  if (!parent) {
-    return 0;
+void WaveForm::write_to(OutputStream &stream) const {
+  stream.writeInt(static_cast<int>(WaveTableVersion));
+  stream.writeInt(static_cast<int>(WaveTableLevels));
+  for (auto &level : levels_) {
+    stream.writeInt(static_cast<int>(level.size));
+    stream.write(level.table.data(), level.table.size() * sizeof(float));
   }
-  auto index = parent->get_index(frequency);
-  auto &cache = parent->resample_cache_[index];
-  auto cache_index = static_cast<int>(round(cache.getNumSamples() * phase));
-  phase += 1.0f / cache.getNumSamples();
-  phase = phase - int(phase);
-  return cache.getSample(0, cache_index);
 }
 
-void WaveFormVoice::fill_next_samples(float frequency, float *buffer, size_t count_to_fill) {
-  auto parent = parent_.lock();
-  if (!parent) {
-    juce::FloatVectorOperations::fill(buffer, 0, int(count_to_fill));
-    return;
+std::shared_ptr<WaveForm> WaveForm::read_from(InputStream &stream) {
+  if (static_cast<uint32_t>(stream.readInt()) != WaveTableVersion || static_cast<size_t>(stream.readInt()) != WaveTableLevels) {
+    return nullptr;
   }
-
-  auto index = parent->get_index(frequency);
-  auto &cache = parent->resample_cache_[index];
-  auto cache_index = static_cast<int>(round(cache.getNumSamples() * phase));
-  auto cache_buf = cache.getReadPointer(0);
-  for (size_t i = 0; i < count_to_fill; i++) {
-    buffer[i] = cache_buf[cache_index];
-    cache_index++;
-    cache_index %= cache.getNumSamples();
+  std::shared_ptr<WaveForm> waveform(new WaveForm());
+  for (auto &level : waveform->levels_) {
+    auto size = static_cast<size_t>(stream.readInt());
+    if (size < WaveTableMinSize || size > WaveTableSize) {
+      return nullptr;
+    }
+    level.size = size;
+    level.table.resize(size + 1);
+    auto bytes = static_cast<int>(level.table.size() * sizeof(float));
+    if (stream.read(level.table.data(), bytes) != bytes) {
+      return nullptr;
+    }
   }
-  phase = float(cache_index) / cache.getNumSamples();
-}
-
-void WaveFormVoice::fill_next_samples(float frequency, AudioBuffer<float> &buffer, size_t count_to_fill) {
-  assert(buffer.getNumChannels() == 1);
-  fill_next_samples(frequency, buffer.getWritePointer(0), count_to_fill);
+  return waveform;
 }
 
-void WaveFormVoice::fill_next_samples(float frequency, AudioBuffer<float> &buffer) {
-  fill_next_samples(frequency, buffer, buffer.getNumSamples());
+std::tuple<const float *, size_t> WaveForm::get_original_waveform() const {
+  return {levels_[0].table.data(), levels_[0].size};
 }
-
-void WaveFormVoice::reset() {
-  phase = 0;
+WaveForm::LevelSelection WaveForm::select_levels(double increment) const {
+  // Level n keeps (WaveTableSize/4) >> n harmonics, so it is alias free up to a phase increment of
+  //  2^(n+1) / WaveTableSize. The lower level is always alias free and is crossfaded into the next
+  //  one while the frequency rises, so sweeps don't click.
+  auto position = std::max(0.0, std::log2(increment * WaveTableSize / 2) + 1);
+  auto lower = std::min(static_cast<size_t>(position), WaveTableLevels - 1);
+  auto upper = std::min(lower + 1, WaveTableLevels - 1);
+  auto fade = lower == upper ? 0.0f : static_cast<float>(position - std::floor(position));
+  auto &lo = levels_[lower];
+  auto &hi = levels_[upper];
+  return {lo.table.data(), static_cast<float>(lo.size), hi.table.data(), static_cast<float>(hi.size), fade};
 }
-
@@ -1,58 +1,58 @@
 #pragma once
 #include <JuceHeader.h>
 
+#include <array>
 #include <utility>
 
-constexpr float DefaultOriginalFrequency = 440.0f;
-constexpr float DefaultWaveFormSize = 256;
-constexpr size_t DefaultFrequencyPerOctave = 12 * 100;
+// Level 0 keeps WaveTableSize/4 harmonics, every following level keeps half of the previous one.
+//  Tables shrink with their bandwidth (never below WaveTableMinSize), so every level is oversampled
+//  at least 4 times and linear interpolation stays clean.
+constexpr size_t WaveTableSize = 2048;
+constexpr size_t WaveTableMinSize = 64;
+constexpr size_t WaveTableLevels = 10;
+// Bump whenever the table layout or the way levels are built changes, cached tables on disk are rebuilt
+constexpr uint32_t WaveTableVersion = 1;
 
-class WaveForm;
-class WaveFormVoice {
+// Octave spaced mipmap of band-limited single cycle tables. Does not depend on the sample rate,
+//  voices pick the level from their phase increment.
+class WaveForm {
  public:
-  explicit WaveFormVoice(std::weak_ptr<const WaveForm> parent) :parent_(std::move(parent)) { }
+  // Tables to read for one phase increment, lower is crossfaded into upper by fade
+  struct LevelSelection {
+    const float *lower;
+    float lower_size;
+    const float *upper;
+    float upper_size;
+    float fade;
+  };
 
-  float next_sample(float frequency);
-  void fill_next_samples(float frequency, float *buffer, size_t count_to_fill);
-  void fill_next_samples(float frequency, AudioBuffer<float> &buffer, size_t count_to_fill);
-  void fill_next_samples(float frequency, AudioBuffer<float> &buffer);
-  void reset();
- private:
-  float phase = 0;
-  std::weak_ptr<const WaveForm> parent_;
-};
-
-class WaveForm :public std::enable_shared_from_this<WaveForm> {
- public:
-  WaveForm(AudioBuffer<float> data, float original_freq, size_t freqs_per_octave, size_t resample_cache_size);
+  // single_cycle is one period of the waveform with WaveTableSize samples
+  explicit WaveForm(const AudioBuffer<float> &single_cycle);
   virtual ~WaveForm() = default;
 
-  size_t memory_size() const;
-  std::unique_ptr<WaveFormVoice> get_voice() const;
   std::tuple<const float*, size_t> get_original_waveform() const;
+  // increment is in cycles per sample
+  LevelSelection select_levels(double increment) const;
+
+  void write_to(OutputStream &stream) const;
+  // Returns nullptr when the stream was written by another version
+  static std::shared_ptr<WaveForm> read_from(InputStream &stream);
  private:
-  friend class WaveFormVoice;
-  size_t get_index(float frequency) const;
-  float get_frequency(size_t index) const;
-  void setup_resample_cache();
+  WaveForm() = default;
+  struct Level {
+    // size + 1 samples, the last one repeats the first so interpolation never wraps
+    std::vector<float> table;
+    size_t size;
+  };
+  void build_levels(const AudioBuffer<float> &single_cycle);
  private:
-  AudioBuffer<float> original_samples_;
-  float original_frequency_;
-
-  float min_frequency_ = 55.0f;
-  size_t freqs_per_octave_;
-  size_t resample_cache_size_;
-
-  std::vector<AudioBuffer<float>> resample_cache_;
-
-  LagrangeInterpolator interpolator_;
+  std::array<Level, WaveTableLevels> levels_;
 };
 
 template <typename FunctionType>
 class FunctionWave :public WaveForm {
  public:
-  FunctionWave(float sample_rate, size_t count, size_t freqs_per_octave, size_t resample_cache_size)
-      :WaveForm(make_single_waveform(count), sample_rate/count, freqs_per_octave, resample_cache_size) { }
+  FunctionWave() :WaveForm(make_single_waveform(WaveTableSize)) { }
 
   static AudioBuffer<float> make_single_waveform(size_t count) {
     FunctionType func;
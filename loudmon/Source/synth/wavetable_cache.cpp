@@ -0,0 +1,115 @@
+#include "wavetable_cache.h"
+
+WaveTableCache &WaveTableCache::instance() {
+  static WaveTableCache cache;
+  return cache;
+}
+
+WaveTableCache::WaveTableCache()
+    :directory_(File::getSpecialLocation(File::userApplicationDataDirectory)
+                    .getChildFile("A1ex").getChildFile("loudmon").getChildFile("wavetables")) {
+  worker_ = std::thread(std::bind(&WaveTableCache::worker_thread, this));
+}
+
+WaveTableCache::~WaveTableCache() {
+  {
+    std::unique_lock<std::mutex> _(lock_);
+    quit_ = true;
+  }
+  jobs_cv_.notify_all();
+  worker_.join();
+}
+
+void WaveTableCache::set_directory(const File &directory) {
+  std::unique_lock<std::mutex> _(lock_);
+  directory_ = directory;
+}
+
+void WaveTableCache::get(const std::string &name, std::function<std::shared_ptr<WaveForm>()> build, Callback on_ready) {
+  std::shared_ptr<const WaveForm> table;
+  {
+    std::unique_lock<std::mutex> _(lock_);
+    auto it = tables_.find(name);
+    if (it != tables_.end()) {
+      table = it->second;
+    } else {
+      auto &callbacks = pending_[name];
+      callbacks.push_back(std::move(on_ready));
+      if (callbacks.size() > 1) {
+        // Already being built
+        return;
+      }
+      jobs_.emplace_back([this, name, build{std::move(build)}]() {
+        auto built = load_or_build(name, build);
+        std::vector<Callback> callbacks;
+        {
+          std::unique_lock<std::mutex> _(lock_);
+          tables_[name] = built;
+          callbacks = std::move(pending_[name]);
+          pending_.erase(name);
+        }
+        for (auto &callback : callbacks) {
+          callback(built);
+        }
+      });
+    }
+  }
+  if (table) {
+    on_ready(std::move(table));
+  } else {
+    jobs_cv_.notify_one();
+  }
+}
+
+void WaveTableCache::worker_thread() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    jobs_cv_.wait(lock, [this]() { return quit_ || !jobs_.empty(); });
+    if (quit_) {
+      return;
+    }
+    auto job = std::move(jobs_.front());
+    jobs_.pop_front();
+    lock.unlock();
+    job();
+    lock.lock();
+  }
+}
+
+File WaveTableCache::cache_file(const std::string &name) const {
+  if (directory_ == File()) {
+    return {};
+  }
+  return directory_.getChildFile(String(name) + ".wt");
+}
+
+std::shared_ptr<const WaveForm> WaveTableCache::load_or_build(const std::string &name, const std::function<std::shared_ptr<WaveForm>()> &build) {
+  File file;
+  {
+    std::unique_lock<std::mutex> _(lock_);
+    file = cache_file(name);
+  }
+  if (file.existsAsFile()) {
+    FileInputStream stream(file);
+    if (stream.openedOk()) {
+      if (auto table = WaveForm::read_from(stream)) {
+        return table;
+      }
+    }
+  }
+
+  auto table = build();
+  if (file != File()) {
+    file.getParentDirectory().createDirectory();
+    // Written next to the target and moved over it, so a concurrent reader never sees a partial file
+    TemporaryFile temp(file);
+    {
+      FileOutputStream stream(temp.getFile());
+      if (stream.openedOk()) {
+        table->write_to(stream);
+      }
+    }
+    temp.overwriteTargetFileWithTemporary();
+  }
+  return table;
+}
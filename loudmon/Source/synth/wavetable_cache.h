@@ -0,0 +1,48 @@
+#pragma once
+#include <JuceHeader.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "waveform.h"
+
+// Process wide cache of built wavetables, so that every plugin instance shares the same tables.
+//  Tables are built on a background worker and optionally persisted to disk. A table is never freed
+//  before the process ends, voices play them through plain pointers.
+class WaveTableCache {
+ public:
+  using Callback = std::function<void(std::shared_ptr<const WaveForm>)>;
+
+  static WaveTableCache &instance();
+  ~WaveTableCache();
+
+  // Where built tables are stored between runs. An empty file disables the disk cache.
+  void set_directory(const File &directory);
+
+  // on_ready is called right away when the table is already built, otherwise from the worker.
+  //  Requests for a table that is being built share that build.
+  void get(const std::string &name, std::function<std::shared_ptr<WaveForm>()> build, Callback on_ready);
+
+ private:
+  WaveTableCache();
+  void worker_thread();
+  std::shared_ptr<const WaveForm> load_or_build(const std::string &name, const std::function<std::shared_ptr<WaveForm>()> &build);
+  File cache_file(const std::string &name) const;
+
+ private:
+  std::mutex lock_;
+  File directory_;
+  std::map<std::string, std::shared_ptr<const WaveForm>> tables_;
+  // Callbacks waiting for a build in progress, by name
+  std::map<std::string, std::vector<Callback>> pending_;
+
+  std::deque<std::function<void()>> jobs_;
+  std::condition_variable jobs_cv_;
+  bool quit_ = false;
+  std::thread worker_;
+};